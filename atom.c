@@ -1,13 +1,12 @@
+#include <pthread.h>
+
 #include "extern.h"
 #include "atom.h"
 
 /* Inspired by David Hanson in C interfaces and implementations */
 
-static struct atom {
-        struct atom *next;
-        int len;
-        char *str;
-} *buckets[2048];
+static struct atom *buckets[2048];
+static pthread_mutex_t atmlock = PTHREAD_MUTEX_INITIALIZER; /* of buckets */
 
 static unsigned long scatter[] = {
         2078917053, 143302914, 1027100827, 1953210302, 755253631, 2002600785,
@@ -88,7 +87,8 @@ inttoatm(long n)
 
 /*
  * natom: returns a pointer to an atom representing the sequence of
- * bytes s of length len.
+ * bytes s of length len.  The atoms can be created by several threads
+ * at once (see readpar).
  */
 symb_t *
 natom(const char *s, int len) {
@@ -102,20 +102,27 @@ natom(const char *s, int len) {
                 h = (h<<1) + scatter[(unsigned char)s[i]];
         h &= NELEMS(buckets)-1;
 
+        pthread_mutex_lock(&atmlock);
         for (p = buckets[h]; p; p = p->next)
                 if (len == p->len) {
                         for (i = 0; i < len && p->str[i] == s[i]; i++)
                                 ;
-                        if (i == len) /* already in the hash table */
+                        if (i == len) { /* already in the hash table */
+                                pthread_mutex_unlock(&atmlock);
                                 return p->str;
+                        }
                 }
         p = smalloc(sizeof (*p) + len + 1);
         p->len = len;
+        p->ver = 0;
+        p->syn = 0;
+        p->imp = 0;
         p->str = (char *)(p + 1);     /* skip the atom structure */
         if (len > 0)
                 memcpy(p->str, s, len);
         p->str[len] = '\0';
         p->next = buckets[h];
         buckets[h] = p;
+        pthread_mutex_unlock(&atmlock);
         return p->str;
 }
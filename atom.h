@@ -3,6 +3,36 @@
 
 typedef const char symb_t;
 
+struct atom {
+        struct atom *next;
+        int len;
+        unsigned ver;           /* version of the bindings of the atom */
+        int syn;                /* syntax class of the atom or zero */
+        int imp;                /* is its global binding imported? */
+        char *str;
+};
+
+/* Return the atom structure whose string is s. */
+#define atmp(s)         ((struct atom *)(s) - 1)
+
+/*
+ * The version is incremented each time the atom is defined or
+ * assigned, see evdef and evset.
+ */
+#define atmver(s)       (atmp(s)->ver)
+
+/*
+ * The syntax class of a keyword is its index in keywords plus one,
+ * see initkeys.  It's zero for any other atom.
+ */
+#define atmsyn(s)       (atmp(s)->syn)
+
+/*
+ * An atom is imported if its global binding comes from a module, see
+ * evimport.  The binding can't be changed afterwards.
+ */
+#define atmimp(s)       (atmp(s)->imp)
+
 extern symb_t *strtoatm(const char *);
 extern symb_t *inttoatm(long);
 extern symb_t *natom(const char *, int);
@@ -0,0 +1,22 @@
+; Cost of escaping with call/cc from a recursion 1000 deep, 20000 times.
+; Run with: time loot < bench/escape.scm
+
+(define (deep n k)
+  (if (= n 0)
+      (k n)
+      (+ 1 (deep (- n 1) k))))
+
+(define (escape n)
+  (call/cc (lambda (k) (deep n k))))
+
+(define (local n)
+  (call/cc (lambda (k) (if (= n 0) (k n) n))))
+
+(define (run depth)
+  (if (= depth 0)
+      (do ((i 0 (+ i 1))) ((= i 20000) 'done)
+        (escape 10)
+        (local i))
+      (car (cons (run (- depth 1)) depth))))
+
+(run 1000)
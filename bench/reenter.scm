@@ -0,0 +1,18 @@
+; Cost of re-entering a continuation captured 1000 calls deep,
+; 20000 times.
+; Run with: time loot < bench/reenter.scm
+
+(define k #f)
+(define n 0)
+
+(define (capture depth)
+  (if (= depth 0)
+      (call/cc (lambda (c) (set! k c) 0))
+      (+ 0 (capture (- depth 1)))))
+
+(define (run)
+  (capture 1000)
+  (set! n (+ n 1))
+  (if (< n 20000) (k n) n))
+
+(run)
@@ -0,0 +1,32 @@
+; Re-entering a continuation captured by a procedure called from a
+; loop, once the loop has ended.  The loop resumes from the iteration
+; of the capture: this should print ((2 1 0) 3), then 6.
+; Run with: loot < bench/reloop.scm
+
+(define k #f)
+(define count 0)
+
+(define (grab x) (call/cc (lambda (c) (set! k c) x)))
+
+(define (run)
+  (let ((r (do ((i 0 (+ i 1)) (acc '() (cons i acc)))
+               ((= i 3) (list acc i))
+             (if (= i 1) (grab i)))))
+    (set! count (+ count 1))
+    (if (= count 1) (k 0))
+    (write r)))
+
+(run)
+
+(define (sum)
+  (let loop ((i 0) (s 0))
+    (if (= i 4)
+        s
+        (begin (if (= i 2) (grab i))
+               (loop (+ i 1) (+ s i))))))
+
+(set! count 0)
+(define res (sum))
+(set! count (+ count 1))
+(if (< count 3) (k 0))
+(write res)
@@ -0,0 +1,22 @@
+; Named lets shadowing an imported variable.  The name of a named let
+; that is not a loop is bound around its body only: this should print
+; (3 2 1 done), 3, then imported.
+; Run with: loot < bench/shadow.scm
+
+(define-module m (export h)
+  (define (h) 'imported))
+
+(import m)
+
+(define (count n)
+  (let h ((n n))
+    (if (= n 0)
+        '(done)
+        (cons n (h (- n 1))))))
+
+(write (count 3))
+(write (let h ((n 3))
+         (if (= n 0)
+             'done
+             (begin (h (- n 1)) n))))
+(write (h))
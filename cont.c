@@ -0,0 +1,233 @@
+#include "extern.h"
+#include "exp.h"
+#include "env.h"
+#include "cont.h"
+#include "eval.h"
+#include "read.h"
+
+/*
+ * First-class continuations.
+ *
+ * A continuation remembers the context of the call/cc frame with
+ * setjmp.  As long as this frame is active, i.e. the continuation is
+ * used to escape from the extent of call/cc, invoking the
+ * continuation is just a longjmp.  To re-enter one once its frame has
+ * returned, we need a copy of the C stack between the call/cc frame
+ * and stackbase.  The stack is then grown past the copied region, the
+ * copy is written back and we longjmp into it.
+ *
+ * The copy is only taken if the continuation may be used after its
+ * frame is left, since most are only used to escape.  While its frame
+ * is active, the stack between it and stackbase doesn't change.  So
+ * it's copied when the continuation is stored by define, set!,
+ * set-car! or set-cdr!, or when the frame is left and the value
+ * returned or passed to another continuation may hold it.
+ */
+
+char *stackbase;                /* bottom of the stack to copy */
+cont_t *ccstack;                /* continuations whose frame is active */
+int npending;                   /* active ones that aren't copied yet */
+
+#define MAXSCAN 256             /* objects looked at by mayhold */
+
+/* Remember the region of the stack between the current frame and stackbase. */
+static void
+mark(cont_t *kp)
+{
+        volatile char here;
+        char *sp = (char *)&here;
+
+        if (sp < stackbase) {   /* the stack grows downward */
+                kp->lo = sp;
+                kp->size = stackbase - sp;
+        } else {
+                kp->lo = stackbase;
+                kp->size = sp - stackbase;
+        }
+}
+
+/*
+ * Mark must not be inlined: its frame has to be below the one of
+ * callcc for the region to include it.
+ */
+static void (*volatile markp)(cont_t *) = mark;
+
+/* Copy the stack of an active continuation if it's not done yet. */
+static void
+save(cont_t *kp)
+{
+        if (kp->pending) {
+                kp->stack = smalloc(kp->size);
+                memcpy(kp->stack, kp->lo, kp->size);
+                kp->pending = 0;
+                npending--;
+        }
+}
+
+/*
+ * Test if the expression may hold a continuation, looking at *np
+ * objects at most.  A function may hold one in its environment.
+ */
+static int
+mayhold(exp_t *ep, int *np)
+{
+        for (; ep; ep = cdr(ep)) {
+                if (--*np < 0)
+                        return 1;
+                if (isproc(ep))
+                        return ptype(ep) == CONT ||
+                               (ptype(ep) == FUNC && fenv(ep) != globenv);
+                if (!ispair(ep))
+                        return 0;
+                if (mayhold(car(ep), np))
+                        return 1;
+        }
+        return 0;
+}
+
+/* The frame of kp is left with the value val. */
+static void
+leave(cont_t *kp, exp_t *val)
+{
+        int n = MAXSCAN;
+
+        if (kp->pending) {
+                if (mayhold(val, &n))
+                        save(kp);
+                else {
+                        kp->pending = 0;
+                        npending--;
+                }
+        }
+}
+
+/* The expression is stored where it may outlive the active frames. */
+void
+ccescape(exp_t *ep)
+{
+        cont_t *kp;
+        int n = MAXSCAN;
+
+        if (isproc(ep) && ptype(ep) == CONT)
+                save(contp(ep));
+        else if (mayhold(ep, &n))
+                for (kp = ccstack; kp; kp = kp->prev)
+                        save(kp);
+}
+
+/*
+ * Call proc with the current continuation.  If full is false, the
+ * continuation can only be used to escape from the extent of call/cc.
+ */
+exp_t *
+callcc(exp_t *proc, int full)
+{
+        cont_t *kp;
+        exp_t *k;
+
+        NEW(kp);
+        kp->prev = ccstack;
+        kp->exstack = exstack;
+        kp->stack = NULL;
+        kp->full = full;
+        kp->pending = 0;
+        NEW(k);
+        type(k) = PROC;
+        NEW(procp(k));
+        ptype(k) = CONT;
+        label(k) = NULL;
+        contp(k) = kp;
+
+        if (full) {
+                (*markp)(kp);
+                kp->pending = 1;
+                npending++;
+        }
+        ccstack = kp;
+        if (setjmp(kp->env) == 0)
+                kp->val = apply(proc, cons(k, null));
+        ccstack = kp->prev;
+        if (kp->pending)
+                leave(kp, listvals(kp->val));
+        return kp->val;
+}
+
+/* Leave the frames of the active continuations down to kp after an error. */
+void
+ccunwind(cont_t *kp)
+{
+        for (; ccstack != kp; ccstack = ccstack->prev)
+                leave(ccstack, NULL);
+}
+
+#define MARGIN  1024            /* free space around the current frame */
+
+static void restore(cont_t *, volatile char *);
+
+/* Grow the stack and call restore again. */
+static void
+grow(cont_t *kp)
+{
+        volatile char pad[MARGIN];
+
+        pad[MARGIN-1] = 0;
+        restore(kp, pad);
+}
+
+/*
+ * Restore the stack copied by save and jump into it.  The pad is
+ * only there to keep the stack grown by grow.
+ */
+static void
+restore(cont_t *kp, volatile char *pad)
+{
+        volatile char here;
+        char *sp = (char *)&here;
+
+        if (kp->lo < stackbase ? sp > kp->lo-MARGIN :
+                                 sp < kp->lo+kp->size+MARGIN)
+                grow(kp);
+        memcpy(kp->lo, kp->stack, kp->size);
+        longjmp(kp->env, 1);
+}
+
+/* Test if the frame of kp is active in the context of ck. */
+static int
+isactive(cont_t *kp, cont_t *ck)
+{
+        for (; ck; ck = ck->prev)
+                if (ck == kp)
+                        return 1;
+        return 0;
+}
+
+/*
+ * Pass the value to the continuation k.  The frames of call/cc that
+ * the jump leaves are saved first if needed.  Those reactivated by a
+ * re-entry may be saved again.
+ */
+void
+throw(exp_t *k, exp_t *val)
+{
+        cont_t *kp, *p;
+
+        kp = contp(k);
+        kp->val = val;
+        if (isactive(kp, ccstack)) {    /* escape */
+                for (; ccstack != kp; ccstack = ccstack->prev)
+                        leave(ccstack, val);
+                exstack = kp->exstack;
+                longjmp(kp->env, 1);
+        }
+        if (kp->stack == NULL)
+                everr("the continuation is no longer valid", k);
+        for (p = ccstack; p; p = p->prev)
+                if (!isactive(p, kp))
+                        leave(p, val);
+        for (npending = 0, p = kp->prev; p; p = p->prev)
+                if ((p->pending = p->full && p->stack == NULL))
+                        npending++;
+        ccstack = kp;
+        exstack = kp->exstack;
+        restore(kp, NULL);
+}
@@ -0,0 +1,28 @@
+#ifndef CONT_H
+#define CONT_H
+
+typedef struct cont {           /* Represents a continuation */
+        struct cont *prev;      /* enclosing continuation at capture */
+        jmp_buf      env;       /* context of the call/cc frame */
+        exfram_t    *exstack;   /* exception stack at capture */
+        int          full;      /* can it be re-entered? */
+        int          pending;   /* may the stack still have to be copied? */
+        char        *stack;     /* copy of the C stack or NULL */
+        char        *lo;        /* lowest address of the copied stack */
+        size_t       size;      /* size of the copy */
+        exp_t       *val;       /* value passed to the continuation */
+} cont_t;
+
+extern char   *stackbase;
+extern cont_t *ccstack;
+extern int     npending;
+
+extern exp_t *callcc(exp_t *, int);
+extern void throw(exp_t *, exp_t *);
+extern void ccescape(exp_t *);
+extern void ccunwind(cont_t *);
+
+/* Call before storing ep where it may outlive the frames of call/cc. */
+#define ccstore(ep)     do { if (npending) ccescape(ep); } while (0)
+
+#endif /* !CONT_H */
@@ -87,15 +87,15 @@ undef(symb_t *s, frame_t *fp)
         }
 }
 
-/* newframe: return a new frame pointer */
+/* newframe: return a new frame pointer with size buckets */
 frame_t *
-newframe(void)
+newframe(size_t size)
 {
         frame_t *fp;
 
         NEW(fp);
-        fp->bucket = calloc(HASHSIZE, sizeof(*fp->bucket));
-        fp->size = HASHSIZE;
+        fp->bucket = scalloc(size, sizeof(*fp->bucket));
+        fp->size = size;
         return fp;
 }
 
@@ -106,20 +106,38 @@ newenv(void)
         env_t *ep;
 
         NEW(ep);
-        ep->fp = newframe();
+        ep->fp = newframe(HASHSIZE);
         ep->ep = NULL;
         return ep;
 }
 
+/*
+ * extsize: extend the environment with an empty frame sized for n
+ * bindings.  A local frame holds few bindings, so it doesn't need as
+ * many buckets as the global one.
+ */
+env_t *
+extsize(size_t n, env_t *envp)
+{
+        env_t *ep;
+
+        NEW(ep);
+        ep->fp = newframe(n > 0 ? n : 1);
+        ep->ep = envp;        /* enclosing environment */
+        return ep;
+}
+
 /* extenv: extend the environment with new bindings */
 env_t *
 extenv(exp_t *blist, env_t *envp)
 {
         env_t *ep;
         exp_t *bind;
+        size_t n;
 
-        ep = newenv();
-        ep->ep = envp;        /* enclosing environment */
+        for (n = 0, bind = blist; !isnull(bind); bind = cdr(bind))
+                n++;
+        ep = extsize(n, envp);
         for (; !isnull(blist); blist = cdr(blist)) {
                 bind = car(blist);
                 install(symp(car(bind)), cdr(bind), ep);
@@ -132,15 +150,14 @@ void
 fdump(frame_t *fp)
 {
         struct nlist *np;
-        char *s;
         int i;
 
         for (i = 0; i < fp->size; i++) {
                 if (fp->bucket[i]) {
                         for (np = fp->bucket[i]; np; np = np->next) {
-                                printf("%d: [%s, %s] ", i, np->name,
-                                       s = tostr(np->defn));
-                                free(s);
+                                printf("%d: [%s, ", i, np->name);
+                                fputexp(np->defn, stdout);
+                                printf("] ");
                         }
                         putchar('\n');
                 }
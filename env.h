@@ -20,12 +20,13 @@ struct nlist {  /* table entry */
 };
 
 extern env_t* globenv;
-extern frame_t *newframe(void);
+extern frame_t *newframe(size_t);
 extern void fdump(frame_t *);
 extern struct nlist *lookup(symb_t *, env_t *);
 extern struct nlist *install(symb_t *, exp_t *, env_t *);
 extern env_t *newenv(void);
 extern env_t *extenv(exp_t *, env_t *);
+extern env_t *extsize(size_t, env_t *);
 extern void undef(symb_t *, frame_t *);
 
 /* fframe: return the first frame in the environment */
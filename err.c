@@ -38,7 +38,7 @@ err_sys(const char *fmt, ...)
         va_end(ap);
 }
 
-exfram_t *exstack = NULL;       /* Reinitialize when loading a new file. */
+TLS exfram_t *exstack = NULL;       /* Reinitialize when loading a new file. */
 
 /* Raise an exception. Has the same format as printf. */
 void raise(const excpt_t *e,
@@ -49,7 +49,7 @@ void raise(const excpt_t *e,
            ...)
 {
         exfram_t *p = exstack;
-        static char msg[MAXLINE];
+        static TLS char msg[MAXLINE];
         va_list ap;
 
         assert(e);
@@ -25,11 +25,14 @@ typedef struct exfram {
 
 enum { ENTERED = 0, RAISED, HANDLED };
 
-extern exfram_t *exstack;
+/* Storage class of the variables private to each thread. */
+#define TLS     __thread
+
+extern TLS exfram_t *exstack;
 void raise(const excpt_t *, const char *, unsigned, unsigned ,const char *,...);
 
-#define RAISE(e, ...) raise(&(e), instream->name, instream->line,instream->col,\
-                            __VA_ARGS__)
+#define RAISE(e, ...) raise(&(e), instream->name, sline(instream),         \
+                            scol(instream), __VA_ARGS__)
 #define RERAISE  raise(exfram.exception, exfram.file, exfram.line, exfram.col, \
                        "%s", exfram.msg)
 #define RETURN   switch (exstack = exstack->prev, 0) default: return
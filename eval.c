@@ -1,3 +1,5 @@
+#include <stdint.h>
+
 #include "extern.h"
 #include "exp.h"
 #include "env.h"
@@ -5,39 +7,236 @@
 #include "type.h"
 #include "read.h"
 #include "stream.h"
+#include "cont.h"
+#include "prim.h"
+#include "fasl.h"
 
 const excpt_t eval_error = { "eval" };
 const excpt_t syntax_error = { "syntax" };
 typedef enum { CAR, CDR } place_t;
 typedef enum { LAND, LOR } logic_t;
 
+enum { TFXN = 1, TFLT = 2, TANY = 4 };  /* types of numbers */
+#define tbit(ep)        (isfxn(ep) ? TFXN : (isfloat(ep) ? TFLT : TANY))
+
+/* Represents a loop (see anloop). */
+struct loop {
+        symb_t    *name;        /* label of the loop */
+        int        nvars;       /* number of loop variables */
+        symb_t   **vars;        /* loop variables */
+        evproc_t **inits;       /* initial values of the variables */
+        evproc_t  *body;        /* body of the loop */
+        int        fresh;       /* new frame at each iteration? */
+        int       *types;       /* inferred type of the variables */
+        int       *owned;       /* can the value be updated in place? */
+        int        nops;        /* number of operators relied upon */
+        symb_t   **ops;         /* operators bound to their primitive */
+        unsigned  *vers;        /* their versions at analysis */
+};
+
+/* Numeric expression computed without allocation (see antnum). */
+struct tnum {
+        int           op;       /* PADD, PSUB, PPROD or -1 for a leaf */
+        evproc_t     *leaf;     /* value of a leaf */
+        struct tnum  *rand[2];  /* operands */
+};
+
+/* Represents a call to the label of a loop (see anjump). */
+struct jump {
+        struct loop   *loop;    /* the loop */
+        evproc_t     **args;    /* new values of the variables */
+        struct tnum  **steps;   /* or their numeric computation */
+};
+
+/* Represents an application to two operands (see nbinapp). */
+struct binapp {
+        evproc_t  *self;        /* evaluation procedure of the node */
+        evproc_t  *op;          /* operator */
+        evproc_t  *rand[2];     /* operands */
+        exp_t     *prim;        /* arithmetic primitive applied so far */
+        unsigned   seen;        /* types of the operands seen so far */
+        int        count;       /* number of evaluations profiled */
+};
+
+/* Represents a body with internal definitions (see anbody). */
+struct body {
+        int         ndefs;      /* number of definitions */
+        symb_t    **vars;       /* the variables defined */
+        evproc_t  **vals;       /* their values */
+        evproc_t   *rest;       /* the remaining body */
+};
+
+/* Represents a let expression without name (see anlet). */
+struct let {
+        int         size;       /* variables and internal definitions */
+        int         nvars;      /* number of variables */
+        symb_t    **vars;       /* the variables */
+        evproc_t  **inits;      /* their initial values */
+        evproc_t   *body;       /* the body */
+};
+
+/* Represents a named let that is not a loop (see anlet). */
+struct named {
+        symb_t     *name;       /* name of the procedure */
+        evproc_t   *op;         /* its lambda expression */
+        int         argc;       /* number of operands */
+        evproc_t  **rands;      /* initial values of the variables */
+};
+
+/* Entry of the hash table of a case expression. */
+struct slot {
+        enum type      tp;      /* type of the datum */
+        unsigned long  key;     /* value of the datum */
+        int            index;   /* index of the clause plus one */
+};
+
+/* Represents a case expression (see ancase). */
+struct dispatch {
+        evproc_t     *key;      /* the key */
+        evproc_t    **clauses;  /* bodies of the clauses */
+        evproc_t     *otherwise; /* else clause or NULL */
+        int           lo;       /* smallest fixnum or char in table */
+        int           size;     /* size of table */
+        int          *table;    /* index of the clause of a fixnum or char */
+        enum type     ttype;    /* type of the datums in table */
+        struct slot  *hash;     /* hash table of the other datums */
+        unsigned      mask;     /* size of hash minus one */
+        exp_t        *numbers;  /* list of (datum . index) for other numbers */
+};
+
+/* Represents an inlined application of an intrinsic (see anprim). */
+struct prim {
+        symb_t    *name;        /* name of the primitive */
+        unsigned   ver;         /* version of the name at analysis */
+        evproc_t  *rand[2];     /* operands */
+        evproc_t  *app;         /* the application if the name changed */
+};
+
+/* Represents a call to a small global procedure (see aninline). */
+struct inl {
+        symb_t         *name;   /* name of the procedure */
+        unsigned        ver;    /* version of the name when linked */
+        struct lambda  *lamp;   /* lambda of the procedure or NULL */
+        int             argc;   /* number of operands */
+        evproc_t      **rands;  /* operands */
+        evproc_t       *op;     /* the operator if it can't be inlined */
+};
+
+/* Represents a call to values (see anvalues). */
+struct vals {
+        symb_t     *name;       /* name of values */
+        unsigned    ver;        /* version of the name at analysis */
+        int         argc;       /* number of operands */
+        evproc_t  **rands;      /* operands */
+        evproc_t   *app;        /* the application if the name changed */
+};
+
+/* Represents a receive or a call to call-with-values (see anrecv). */
+struct recv {
+        symb_t         *name;   /* name of call-with-values or NULL */
+        unsigned        ver;    /* version of the name at analysis */
+        evproc_t       *prod;   /* the values or the producer */
+        int             thunk;  /* is prod a procedure to call? */
+        struct lambda  *lamp;   /* lambda of the consumer or NULL */
+        evproc_t       *cons;   /* otherwise the consumer */
+        evproc_t       *app;    /* the application if the name changed */
+};
+
+/* Represents a module (see anmodule). */
+struct module {
+        symb_t         *name;   /* name of the module */
+        exp_t          *exports; /* exported variables */
+        exp_t          *imports; /* modules imported by the module */
+        struct lambda  *lamp;   /* body returning their values */
+        exp_t          *vals;   /* values of the exported variables */
+        struct module  *next;
+};
+
+/* Stage of a fused chain of list procedures (see anfuse). */
+struct stage {
+        enum lindex  op;        /* map, reverse, foldl or foldr */
+        symb_t      *name;      /* name of the procedure */
+        unsigned     ver;       /* version of the name at analysis */
+        evproc_t    *proc;      /* procedure of map and the folds */
+        evproc_t    *init;      /* initial value of the folds */
+};
+
+/* Represents a fused chain of list procedures (see anfuse). */
+struct fuse {
+        int           nstage;   /* number of stages */
+        struct stage *stages;   /* from the outermost to the innermost */
+        symb_t       *name;     /* name of append or NULL */
+        unsigned      ver;      /* version of append at analysis */
+        int           nsrc;     /* number of lists appended */
+        evproc_t    **srcs;     /* lists traversed */
+        evproc_t     *app;      /* the applications if a name changed */
+};
+
 static exp_t *evself(exp_t *, env_t *);
 static exp_t *evvar(exp_t *, env_t *);
+static exp_t *evimpvar(exp_t **, env_t *);
 static exp_t *evdef(void **, env_t *);
 static exp_t *evif(evproc_t **, env_t *);
 static exp_t *evbegin(evproc_t **, env_t *);
-static exp_t *evlambda(void **, env_t *);
+static exp_t *evlambda(struct lambda *, env_t *);
 static exp_t *evapp(evproc_t **, env_t *);
 static exp_t *evcond(evproc_t **, env_t *);
+static exp_t *evcase(struct dispatch *, env_t *);
 static exp_t *evset(void **, env_t *);
 static exp_t *evsetpair(evproc_t **, env_t *);
 static exp_t *evor(evproc_t **, env_t *);
 static exp_t *evand(evproc_t **, env_t *);
-static exp_t *evlet(evproc_t **, env_t *);
-static exp_t *evqquote(evproc_t **, env_t *);
+static exp_t *evlet(struct let *, env_t *);
+static exp_t *evbody(struct body *, env_t *);
+static exp_t *evnamed(struct named *, env_t *);
+static exp_t *evqcons(evproc_t **, env_t *);
+static exp_t *evsplice(evproc_t **, env_t *);
+static exp_t *evloop(struct loop *, env_t *);
+static exp_t *evjump(struct jump *, env_t *);
+static exp_t *evbinapp(struct binapp *, env_t *);
+static exp_t *evbinfxn(struct binapp *, env_t *);
+static exp_t *evbinflt(struct binapp *, env_t *);
+static exp_t *evcar(struct prim *, env_t *);
+static exp_t *evcdr(struct prim *, env_t *);
+static exp_t *evcons(struct prim *, env_t *);
+static exp_t *eveq(struct prim *, env_t *);
+static exp_t *evadd(struct prim *, env_t *);
+static exp_t *evlt(struct prim *, env_t *);
+static exp_t *evfuse(struct fuse *, env_t *);
+static exp_t *evinline(struct inl *, env_t *);
+static exp_t *evvalues(struct vals *, env_t *);
+static exp_t *evrecv(struct recv *, env_t *);
+static exp_t *evmodule(struct module *, env_t *);
+static exp_t *evimport(exp_t *, env_t *);
 
 static evproc_t *anquote(exp_t *);
 static evproc_t *andef(exp_t *);
 static evproc_t *anif(exp_t *);
 static evproc_t *anbegin(exp_t *);
 static evproc_t *anlambda(exp_t *);
+static evproc_t *anbody(struct lambda *, struct loop *);
+static struct lambda *chklambda(exp_t *);
 static evproc_t *anapp(exp_t *);
+static evproc_t *ancall(exp_t *, int);
+static evproc_t *anprim(exp_t *, int);
+static evproc_t *anfuse(exp_t *, int);
+static evproc_t *aninline(exp_t *, int);
+static evproc_t *anvalues(exp_t *, int);
+static evproc_t *anrecv(exp_t *);
+static evproc_t *ancallvals(exp_t *, int);
+static evproc_t *anvar(exp_t *);
+static evproc_t *anmodule(exp_t *);
+static evproc_t *animport(exp_t *);
 static evproc_t *ancond(exp_t *);
+static evproc_t *ancase(exp_t *);
 static evproc_t *anset(exp_t *);
 static evproc_t *ansetpair(exp_t *, place_t);
 static evproc_t *anlogic(exp_t *, logic_t);
 static evproc_t *anlet(exp_t *);
 static evproc_t *anqquote(exp_t *);
+static evproc_t *ando(exp_t *);
+static evproc_t *anloop(exp_t *, exp_t *, exp_t *, exp_t *);
+static evproc_t *napp(evproc_t *, int, evproc_t **);
 
 /*
  * Check the syntax of the expression and return a corresponding
@@ -49,37 +248,49 @@ analyze(exp_t *ep)
         if (isself(ep))
                 return nevproc(evself, ep);
         else if (isvar(ep))
-                return nevproc(evvar, ep);
-        else if (isquote(ep))
+                return anvar(ep);
+        else if (!ispair(ep))
+                anerr("bad syntax in", ep);
+        switch (isatom(car(ep)) ? atmsyn(symp(car(ep)))-1 : -1) {
+        case QUOTE:
                 return anquote(ep);
-        else if (isdef(ep))
+        case DEFINE:
                 return andef(ep);
-        else if (isif(ep))
+        case IF:
                 return anif(ep);
-        else if (isbegin(ep))
+        case BEGIN:
                 return anbegin(ep);
-        else if (islambda(ep))
+        case LAMBDA:
                 return anlambda(ep);
-        else if (iscond(ep))
+        case COND:
                 return ancond(ep);
-        else if (isset(ep))
+        case CASE:
+                return ancase(ep);
+        case SET:
                 return anset(ep);
-        else if (issetcar(ep))
+        case SETCAR:
                 return ansetpair(ep, CAR);
-        else if (issetcdr(ep))
+        case SETCDR:
                 return ansetpair(ep, CDR);
-        else if (isor(ep))
+        case OR:
                 return anlogic(ep, LOR);
-        else if (isand(ep))
+        case AND:
                 return anlogic(ep, LAND);
-        else if (islet(ep))
+        case LET:
                 return anlet(ep);
-        else if (isqquote(ep))
+        case DO:
+                return ando(ep);
+        case QQUOTE:
                 return anqquote(ep);
-        else if (ispair(ep))    /* application */
+        case RECEIVE:
+                return anrecv(ep);
+        case MODULE:
+                return anmodule(ep);
+        case IMPORT:
+                return animport(ep);
+        default:                /* application */
                 return anapp(ep);
-        else
-                anerr("bad syntax in", ep);
+        }
         return NULL;            /* not reached */
 }
 
@@ -89,11 +300,249 @@ evproc(evproc_t *epp, env_t *envp)
         return epp->eval(epp->argv, envp);
 }
 
-/* Evaluate the expression in the environment. */
+int eager;                      /* analyze the lambda bodies at once */
+
+static struct loop *curloop;    /* innermost loop being analyzed */
+static exp_t *scope;            /* variables bound around the expression */
+
+static exp_t *vallist(exp_t *);
+
+/*
+ * Evaluate the expression in the environment.  Multiple values are
+ * returned as a list, and no values as NULL.
+ */
 exp_t *
 eval(exp_t *exp, env_t *envp)
 {
-        return evproc(analyze(exp), envp);
+        return evalproc(toproc(exp), envp);
+}
+
+/* Return the evaluation procedure of a top-level expression. */
+evproc_t *
+toproc(exp_t *exp)
+{
+        curloop = NULL;         /* in case the last analysis failed */
+        scope = NULL;
+        return analyze(exp);
+}
+
+/* Evaluate an evaluation procedure returned by toproc or getproc. */
+exp_t *
+evalproc(evproc_t *epp, env_t *envp)
+{
+        return vallist(evproc(epp, envp));
+}
+
+/* Entry of the cache of analyzed expressions (see cached). */
+struct cache {
+        exp_t          *key;    /* copy of the expression */
+        unsigned long   hash;   /* hash value of the expression */
+        evproc_t       *epp;    /* its evaluation procedure */
+        struct cache   *next;
+};
+
+static struct cache **ctab;     /* buckets of the cache */
+static unsigned long csize;     /* number of buckets */
+static unsigned long ccount;    /* number of entries */
+
+#define HASHDEPTH       32      /* pairs hashed in an expression */
+#define CACHEMAX        8192    /* entries in the cache before flushing */
+
+/* Test if a form quotes its operand, which is then compared by identity. */
+static inline int
+isquoted(const exp_t *ep)
+{
+        return (isquote((exp_t *)ep) || isqquote((exp_t *)ep)) &&
+                ispair(cdr(ep));
+}
+
+/*
+ * Return the bits of a float.  Unlike with ==, -0.0 differs from 0.0
+ * and a NaN is the same as itself.
+ */
+static uint64_t
+fltbits(double d)
+{
+        uint64_t bits;
+
+        memcpy(&bits, &d, sizeof(bits));
+        return bits;
+}
+
+/*
+ * Return the hash value of a datum.  Pairs, strings and procedures
+ * are hashed by identity.
+ */
+static unsigned long
+hashval(const exp_t *ep)
+{
+        if (ep == NULL)
+                return 0;
+        switch (type(ep)) {
+        case FIXNUM:
+                return fixnum(ep);
+        case CHAR:
+                return (unsigned char)char(ep);
+        case FLOAT:
+                return fltbits(flt(ep)) ^ fltbits(flt(ep)) >> 32;
+        case RAT:
+                return num(ep) * 31 + den(ep);
+        default:                /* compared by their pointer */
+                return (unsigned long)symp(ep) >> 3;
+        }
+}
+
+/* Return the hash value of an expression, see issame. */
+static unsigned long
+hashexp(const exp_t *ep, int *np)
+{
+        unsigned long h;
+
+        if (!ispair(ep))
+                return hashval(ep);
+        if (isquoted(ep))
+                return hashval(car(ep)) * 37 + hashval(cadr(ep));
+        for (h = 0; ispair(ep) && (*np)-- > 0; ep = cdr(ep))
+                h = h * 31 + hashexp(car(ep), np);
+        return h;
+}
+
+/* Test if two datums are the same, see hashval. */
+static int
+issameval(const exp_t *a, const exp_t *b)
+{
+        if (a == NULL || b == NULL || type(a) != type(b))
+                return a == b;
+        switch (type(a)) {
+        case FIXNUM:
+                return fixnum(a) == fixnum(b);
+        case CHAR:
+                return char(a) == char(b);
+        case FLOAT:
+                return fltbits(flt(a)) == fltbits(flt(b));
+        case RAT:
+                return num(a) == num(b) && den(a) == den(b);
+        default:
+                return symp(a) == symp(b);
+        }
+}
+
+/*
+ * Test if two expressions are analyzed the same way.  They must have
+ * the same structure, except for the datums of quote and quasiquote
+ * which must be identical, since their value is the datum itself.
+ */
+static int
+issame(const exp_t *a, const exp_t *b)
+{
+        for (; ispair(a) && ispair(b); a = cdr(a), b = cdr(b)) {
+                if (isquoted(a) != isquoted(b))
+                        return 0;
+                if (isquoted(a))
+                        return issameval(car(a), car(b)) &&
+                                issameval(cadr(a), cadr(b)) &&
+                                issame(cddr(a), cddr(b));
+                if (!issame(car(a), car(b)))
+                        return 0;
+        }
+        return !ispair(a) && !ispair(b) && issameval(a, b);
+}
+
+/* Copy the pairs of an expression that aren't quoted. */
+static exp_t *
+copyexp(exp_t *ep)
+{
+        if (!ispair(ep) || isquoted(ep))
+                return ep;
+        return cons(copyexp(car(ep)), copyexp(cdr(ep)));
+}
+
+/*
+ * Return the evaluation procedure of the expression from the cache.
+ * The expression is analyzed and its copy entered in the cache if
+ * it's not found, so that it can be mutated afterward.
+ */
+static evproc_t *
+cached(exp_t *ep)
+{
+        struct cache *cp, **old;
+        unsigned long h, i, osize;
+        int n;
+
+        n = HASHDEPTH;
+        h = hashexp(ep, &n);
+        if (ctab != NULL)
+                for (cp = ctab[h % csize]; cp; cp = cp->next)
+                        if (cp->hash == h && issame(cp->key, ep))
+                                return cp->epp;
+
+        NEW(cp);
+        cp->key = copyexp(ep);
+        cp->hash = h;
+        curloop = NULL;
+        scope = NULL;
+        cp->epp = analyze(cp->key);
+        if (ccount == CACHEMAX) { /* start anew */
+                for (i = 0; i < csize; i++)
+                        while (ctab[i]) {
+                                struct cache *np = ctab[i];
+
+                                ctab[i] = np->next;
+                                free(np);
+                        }
+                ccount = 0;
+        } else if (ccount >= csize) {   /* grow the table */
+                old = ctab;
+                osize = csize;
+                csize = csize ? 2*csize : HASHSIZE;
+                ctab = scalloc(csize, sizeof(*ctab));
+                for (i = 0; i < osize; i++)
+                        while (old[i]) {
+                                struct cache *np = old[i];
+
+                                old[i] = np->next;
+                                np->next = ctab[np->hash % csize];
+                                ctab[np->hash % csize] = np;
+                        }
+                free(old);
+        }
+        cp->next = ctab[h % csize];
+        ctab[h % csize] = cp;
+        ccount++;
+        return cp->epp;
+}
+
+/*
+ * Evaluate the expression in the environment, reusing the analysis
+ * of an expression of the same shape if any.
+ */
+exp_t *
+evcached(exp_t *exp, env_t *envp)
+{
+        return evproc(cached(exp), envp);
+}
+
+/* Return a procedure without parameters evaluating the expression. */
+exp_t *
+compile(exp_t *exp, env_t *envp)
+{
+        return nproc(nfunc(nlam(null, NULL, NULL, cached(exp)), envp));
+}
+
+/* Test if the symbol is bound by an enclosing lambda or loop. */
+static int
+islocal(symb_t *s)
+{
+        exp_t *fp, *p;
+
+        for (fp = scope; ispair(fp); fp = cdr(fp)) {
+                for (p = car(fp); ispair(p); p = cdr(p))
+                        if (symp(car(p)) == s)
+                                return 1;
+                if (issym(p) && symp(p) == s)
+                        return 1;
+        }
+        return 0;
 }
 
 #define push(x, lst)	((lst) = cons(x, lst))
@@ -102,28 +551,159 @@ eval(exp_t *exp, env_t *envp)
 exp_t *
 apply(exp_t *op, exp_t *args)
 {
+        evproc_t *bodyp;
+        env_t *ep;
         exp_t *pars;
-        exp_t *binds;           /* binding list */
 
         if (!isproc(op))
                 everr("expression is not a procedure", op);
         if (ptype(op) == PRIM) /* primitive */
                 return primp(op)(args);
+        if (ptype(op) == CONT) { /* continuation */
+                if (isnull(args) || !isnull(cdr(args)))
+                        everr("a continuation expects one argument, given",
+                              args);
+                throw(op, car(args));
+        }
 
         /* function */
-        for (pars = fpar(op), binds = null;
-             ispair(pars);
+        bodyp = fbody(op) ? fbody(op) : anbody(flam(op), NULL);
+        ep = extsize(flam(op)->nlocals, fenv(op));
+        for (pars = fpar(op); ispair(pars);
              pars = cdr(pars), args = cdr(args)) {
                 if (isnull(args))
                         everr("too few arguments provided to", op);
-                push(cons(car(pars), car(args)), binds);
+                install(symp(car(pars)), car(args), ep);
         }
         if (!isnull(pars))      /* variable length arguments */
-                push(cons(pars, args), binds);
+                install(symp(pars), args, ep);
         else if (!isnull(args))
                 everr("too many arguments provided to", op);
 
-        return evproc(fbody(op), extenv(binds, fenv(op)));
+        return evproc(bodyp, ep);
+}
+
+/*
+ * Multiple values are passed in registers: values stores them in
+ * valreg and returns the address of multiple, unless there's exactly
+ * one which is returned as is.  A consumer must take them before
+ * anything else is evaluated.  Where a single value is expected,
+ * single makes sure that multiple isn't stored or passed on.
+ */
+static exp_t multiple = { ATOM, { "*values*" } };
+static exp_t **valreg;          /* the values */
+static int nvals;               /* number of values */
+static int valsize;             /* size of valreg */
+
+/*
+ * Return res unless it holds multiple values, which can't be used as
+ * a single one.
+ */
+static inline exp_t *
+single(exp_t *res)
+{
+        if (res == &multiple)
+                RAISE1(eval_error,
+                       "%d values are given where one is expected", nvals);
+        return res;
+}
+
+/* Make room for n values in the registers. */
+static inline void
+growvals(int n)
+{
+        if (n > valsize)
+                valreg = srealloc(valreg, (valsize = n)*sizeof(*valreg));
+}
+
+/* Return the elements of the list as multiple values. */
+exp_t *
+values(exp_t *args)
+{
+        exp_t *p;
+        int n;
+
+        for (n = 0, p = args; ispair(p); p = cdr(p))
+                n++;
+        if (n == 1)
+                return car(args);
+        growvals(n);
+        for (nvals = 0; ispair(args); args = cdr(args))
+                valreg[nvals++] = car(args);
+        return &multiple;
+}
+
+/* Return the list of the values res. */
+exp_t *
+listvals(exp_t *res)
+{
+        exp_t *lst;
+        int i;
+
+        if (res != &multiple)
+                return cons(res, null);
+        for (lst = null, i = nvals; i > 0; i--)
+                lst = cons(valreg[i-1], lst);
+        return lst;
+}
+
+/* Same as listvals but a single value is returned as is, and none as NULL. */
+static exp_t *
+vallist(exp_t *res)
+{
+        if (res != &multiple)
+                return res;
+        return nvals == 0 ? NULL : listvals(res);
+}
+
+/*
+ * Bind the parameters of the lambda to the values res in a new frame
+ * extending envp, and evaluate its body.  The values go directly from
+ * the registers to the frame.
+ */
+static exp_t *
+deliver(struct lambda *lp, env_t *envp, exp_t *res, exp_t *op)
+{
+        exp_t **vals, *pars, *rest;
+        evproc_t *bodyp;
+        env_t *ep;
+        int i, n;
+
+        if (res == &multiple)
+                n = nvals, vals = valreg;
+        else
+                n = 1, vals = &res;
+        bodyp = lp->bodyp ? lp->bodyp : anbody(lp, NULL);
+        ep = extsize(lp->nlocals, envp);
+        for (i = 0, pars = lp->parp; ispair(pars); pars = cdr(pars), i++) {
+                if (i == n)
+                        everr("too few values provided to", op);
+                install(symp(car(pars)), vals[i], ep);
+        }
+        if (!isnull(pars)) {    /* variable number of values */
+                for (rest = null; n > i; n--)
+                        rest = cons(vals[n-1], rest);
+                install(symp(pars), rest, ep);
+        } else if (i != n)
+                everr("too many values provided to", op);
+
+        return evproc(bodyp, ep);
+}
+
+/* Apply the procedure to the values res. */
+static exp_t *
+consume(exp_t *op, exp_t *res)
+{
+        if (isproc(op) && ptype(op) == FUNC)
+                return deliver(flam(op), fenv(op), res, op);
+        return apply(op, listvals(res));
+}
+
+/* Call the consumer with the values returned by the producer. */
+exp_t *
+callvals(exp_t *prod, exp_t *op)
+{
+        return consume(op, apply(prod, null));
 }
 
 /* * * * * * * * * * * * * * * *
@@ -189,6 +769,26 @@ bind(exp_t **varp, exp_t **valp, exp_t *lst)
                 anerr("the expression couldn't be defined", ep);
 }
 
+/*
+ * Analyze a variable.  An imported global variable can't change, so
+ * its value is used directly; the name is kept for putproc.
+ */
+static evproc_t *
+anvar(exp_t *ep)
+{
+        struct nlist *np;
+        exp_t **argv;
+
+        if (atmimp(symp(ep)) && !islocal(symp(ep)) &&
+            (np = lookup(symp(ep), globenv))) {
+                argv = smalloc(2*sizeof(*argv));
+                argv[0] = np->defn;
+                argv[1] = ep;
+                return nevproc(evimpvar, argv);
+        }
+        return nevproc(evvar, ep);
+}
+
 /* Analyze the syntax of an if expression. */
 static evproc_t *
 anif(exp_t *ep)
@@ -231,35 +831,17 @@ anbegin(exp_t *ep)
 }
 
 #define nseq(ep)           (cons(keywords[BEGIN], ep))
-#define nset(var, val)	   (cons(keywords[SET], cons(var, cons(val, null))))
-#define nlet(binds, body)  (cons(keywords[LET], cons(binds, body)))
 #define nquote(exp)        (cons(keywords[QUOTE], cons(exp, null)))
 
 static void scan_defs(exp_t **, exp_t **, exp_t **, exp_t *);
 
-/* Analyze the syntax of a lambda expression.
- * Make internal definitions simultaneous by transforming
- *    (lambda <vars>
- *      (define u <e1>)
- *      (define v <e2>)
- *      <e3>)
- * into the following procedure
- *    (lambda <vars>
- *      (let ((u '*unassigned*)
- *            (v '*unassigned*))
- *        (set! u <e1>)
- *        (set! v <e2>)
- *        <e3>))
- */
-static evproc_t *
-anlambda(exp_t *ep)
+/* Check that pars is a list of distinct symbols or a symbol. */
+static void
+chkpars(exp_t *pars)
 {
-        void **argv;
-        exp_t *lp, *p, *vars, *vals, *body;
+        exp_t *lp, *p;
 
-        if (isnull(cdr(ep)) || isnull(cddr(ep)))
-                anerr("bad syntax in", ep);
-        for (lp = cadr(ep); ispair(lp); lp = cdr(lp)) {
+        for (lp = pars; ispair(lp); lp = cdr(lp)) {
                 if (!issym(car(lp)))
                         anerr("should be a symbol", car(lp));
                 for (p = cdr(lp); ispair(p); p = cdr(p))
@@ -268,25 +850,85 @@ anlambda(exp_t *ep)
         }
         if (!isnull(lp) && !issym(lp))
                 anerr("should be null or a symbol", lp);
+}
 
-        /* Make the internal definitions simultaneous. */
-        scan_defs(&vars, &vals, &body, cddr(ep));
-        if (!isnull(vars)) {
-                exp_t *binds, *v;
-                for (v = vars; !isnull(v); v = cdr(v), vals = cdr(vals))
-                        push(nset(car(v), car(vals)), body);
-                for (binds = null; !isnull(vars); vars = cdr(vars))
-                        push(cons(car(vars),
-                                  cons(nquote(undefined), null)),
-                             binds);
-                cddr(ep) = cons(nlet(binds, body), null);
-        }
+/*
+ * Analyze the syntax of a lambda expression.  The body is analyzed
+ * later by anbody, see below.
+ */
+static evproc_t *
+anlambda(exp_t *ep)
+{
+        struct lambda *lp;
 
-        argv = smalloc(2*sizeof(*argv));
-        argv[0] = (void *)cadr(ep);
-        argv[1] = (void *)anbegin(nseq(cddr(ep)));
+        lp = chklambda(ep);
+        if (eager)
+                anbody(lp, NULL);
+        return nevproc(evlambda, lp);
+}
+
+/* Check the syntax of a lambda expression and return its descriptor. */
+static struct lambda *
+chklambda(exp_t *ep)
+{
+        if (isnull(cdr(ep)) || isnull(cddr(ep)))
+                anerr("bad syntax in", ep);
+        chkpars(cadr(ep));
+        return nlam(cadr(ep), cddr(ep), scope, NULL);
+}
 
-        return nevproc(evlambda, argv);
+/*
+ * Analyze the body of a lambda expression.  It's done on the first
+ * call of one of its functions unless eager is set, so that the
+ * procedures never called aren't analyzed at all.  The variables
+ * bound around the lambda are restored for the analysis.  The body
+ * is part of the given loop or none, since the function may be
+ * called after the loop ends.
+ *
+ * The internal definitions are bound in the frame of the parameters.
+ * They are first bound to *undefined* and then assigned in sequence,
+ * so that they're simultaneous like in a letrec*.
+ */
+static evproc_t *
+anbody(struct lambda *lp, struct loop *loop)
+{
+        struct loop *outer;
+        struct body *bp;
+        exp_t *vars, *vals, *body, *sp, *p;
+        int i;
+
+        scan_defs(&vars, &vals, &body, lp->body);
+        vars = nreverse(vars);
+        vals = nreverse(vals);
+        for (lp->nlocals = 0, p = lp->parp; ispair(p); p = cdr(p))
+                lp->nlocals++;
+        if (!isnull(p))
+                lp->nlocals++;
+
+        outer = curloop;
+        sp = scope;
+        curloop = loop;
+        scope = cons(vars, cons(lp->parp, lp->scope));
+        if (isnull(vars))
+                lp->bodyp = anbegin(nseq(body));
+        else {
+                NEW(bp);
+                for (bp->ndefs = 0, p = vars; ispair(p); p = cdr(p))
+                        bp->ndefs++;
+                bp->vars = smalloc(bp->ndefs*sizeof(*bp->vars));
+                bp->vals = smalloc(bp->ndefs*sizeof(*bp->vals));
+                for (i = 0; i < bp->ndefs; i++, vars = cdr(vars)) {
+                        bp->vars[i] = symp(car(vars));
+                        bp->vals[i] = analyze(car(vals));
+                        vals = cdr(vals);
+                }
+                bp->rest = anbegin(nseq(body));
+                lp->nlocals += bp->ndefs;
+                lp->bodyp = nevproc(evbody, bp);
+        }
+        curloop = outer;
+        scope = sp;
+        return lp->bodyp;
 }
 
 /*
@@ -304,7 +946,8 @@ scan_defs(exp_t **varsp, exp_t **valsp, exp_t **bodyp, exp_t *ep)
                 push(var, *varsp);
                 push(val, *valsp);
         }
-        *bodyp = body;
+        if (!ispair(*bodyp = body))
+                anerr("should have an expression after the definitions", ep);
         for (body = cdr(body); ispair(body); body = cdr(body))
                 if (isdef(car(body)))
                         anerr("should be at the beginning of the body",
@@ -360,6 +1003,137 @@ ancond(exp_t *ep)
         return nevproc(evcond, argv);
 }
 
+#define DENSITY 2       /* maximum ratio of a table size to its entries */
+
+/* Return the key of a datum in the hash table of a case expression. */
+static unsigned long
+hkey(const exp_t *ep)
+{
+        return isfxn(ep) ? (unsigned long)fixnum(ep) :
+                (ischar(ep) ? (unsigned char)char(ep) :
+                 (unsigned long)symp(ep));
+}
+
+/* Return the slot of the datum ep in the hash table of dp. */
+static struct slot *
+hfind(struct dispatch *dp, const exp_t *ep)
+{
+        unsigned long key;
+        unsigned h;
+
+        key = hkey(ep);
+        for (h = (key ^ key>>9) * 31; ; h++) {
+                h &= dp->mask;
+                if (dp->hash[h].index == 0 ||
+                    (dp->hash[h].tp == type(ep) && dp->hash[h].key == key))
+                        return dp->hash+h;
+        }
+}
+
+/*
+ * Analyze the syntax of a case expression.  The datums are checked
+ * once here.  If the fixnums or the characters are dense enough, the
+ * clause of each of them is stored in a table indexed by its value.
+ * The other fixnums and characters, the symbols and the booleans are
+ * stored in a hash table.  The key is then found without testing the
+ * clauses one by one.  Only rationals and floats are compared in
+ * sequence.
+ */
+static evproc_t *
+ancase(exp_t *ep)
+{
+        struct dispatch *dp;
+        struct slot *sp;
+        exp_t *cl, *clauses, *d;
+        int argc, ndat, nfxn, nchar, lo, hi, clo, chi, i;
+
+        if (!ispair(cdr(ep)))
+                anerr("bad syntax in", ep);
+        argc = ndat = nfxn = nchar = 0;
+        lo = clo = INT_MAX;
+        hi = chi = INT_MIN;
+        for (clauses = cddr(ep); ispair(clauses); clauses = cdr(clauses)) {
+                if (!ispair(cl = car(clauses)) || !ispair(cdr(cl)))
+                        anerr("should be a list of datums and values", cl);
+                if (iselse(car(cl))) {
+                        if (!isnull(cdr(clauses)))
+                                anerr("else clause must be last", ep);
+                        continue;
+                }
+                argc++;
+                for (d = car(cl); ispair(d); d = cdr(d)) {
+                        ndat++;
+                        if (isfxn(car(d))) {
+                                nfxn++;
+                                lo = fixnum(car(d)) < lo ? fixnum(car(d)) : lo;
+                                hi = fixnum(car(d)) > hi ? fixnum(car(d)) : hi;
+                        } else if (ischar(car(d))) {
+                                nchar++;
+                                clo = char(car(d)) < clo ? char(car(d)) : clo;
+                                chi = char(car(d)) > chi ? char(car(d)) : chi;
+                        } else if (!isatom(car(d)) && !isbool(car(d)) &&
+                                   !israt(car(d)) && !isfloat(car(d)))
+                                anerr("bad datum", car(d));
+                }
+                if (!isnull(d))
+                        anerr("should be a list of datums", car(cl));
+        }
+        if (!isnull(clauses))
+                anerr("should be a list", ep);
+
+        NEW(dp);
+        dp->key = analyze(cadr(ep));
+        dp->clauses = smalloc(argc*sizeof(*dp->clauses));
+        dp->otherwise = NULL;
+        dp->table = NULL;
+        dp->size = 0;
+        if (nfxn && (long)hi-lo < DENSITY*nfxn) {
+                dp->ttype = FIXNUM;
+                dp->lo = lo;
+                dp->size = hi-lo+1;
+                ndat -= nfxn;
+        } else if (nchar && chi-clo < DENSITY*nchar) {
+                dp->ttype = CHAR;
+                dp->lo = clo;
+                dp->size = chi-clo+1;
+                ndat -= nchar;
+        }
+        if (dp->size)
+                dp->table = scalloc(dp->size, sizeof(*dp->table));
+        for (dp->mask = 1; dp->mask < DENSITY*ndat; dp->mask <<= 1)
+                ;
+        dp->hash = scalloc(dp->mask--, sizeof(*dp->hash));
+        dp->numbers = null;
+
+        for (i = 0, clauses = cddr(ep); ispair(clauses); clauses = cdr(clauses)) {
+                cl = car(clauses);
+                if (iselse(car(cl))) {
+                        dp->otherwise = analyze(nseq(cdr(cl)));
+                        continue;
+                }
+                dp->clauses[i++] = analyze(nseq(cdr(cl)));
+                for (d = car(cl); ispair(d); d = cdr(d))
+                        if (dp->table && type(car(d)) == dp->ttype) {
+                                int *ip = dp->table + (isfxn(car(d)) ?
+                                                       fixnum(car(d)) :
+                                                       char(car(d))) - dp->lo;
+                                if (*ip == 0)
+                                        *ip = i;
+                        } else if (israt(car(d)) || isfloat(car(d)))
+                                dp->numbers = nconc(dp->numbers,
+                                                    cons(cons(car(d),
+                                                              nfixnum(i)),
+                                                         null));
+                        else if ((sp = hfind(dp, car(d)))->index == 0) {
+                                sp->tp = type(car(d));
+                                sp->key = hkey(car(d));
+                                sp->index = i;
+                        }
+        }
+
+        return nevproc(evcase, dp);
+}
+
 /* Analyze the syntax of a set! expression. */
 static evproc_t *
 anset(exp_t *ep)
@@ -414,12 +1188,17 @@ anlogic(exp_t *ep, logic_t lg)
         return nevproc((lg == LOR ? evor : evand), argv);
 }
 
+static int isloop(exp_t *, exp_t *, exp_t *);
+
 /* Analyze the syntax of a `let' expression. */
 static evproc_t *
 anlet(exp_t *ep)
 {
-        evproc_t **argv;
+        struct lambda *lp;
+        struct let *letp;
+        struct named *np;
         exp_t *bd, *binds, *body, *name, *op, *pars, *vals;
+        int argc, i;
 
         if (isnull(cdr(ep)))
                 anerr("bad syntax", ep);
@@ -435,7 +1214,8 @@ anlet(exp_t *ep)
                 body = cddr(ep);
         }
 
-        for (pars = vals = null; ispair(binds); binds = cdr(binds))
+        for (argc = 0, pars = vals = null; ispair(binds);
+             binds = cdr(binds), argc++)
                 if (issym(bd = car(binds))) {
                         push(bd, pars);
                         push(null, vals);
@@ -446,316 +1226,2560 @@ anlet(exp_t *ep)
                         anerr("bad binding syntax", ep);
         if (!isnull(binds))
                 anerr("should be a list of bindings", binds);
+        pars = nreverse(pars);
+        vals = nreverse(vals);
+        if (name && isloop(name, pars, body))
+                return anloop(name, pars, vals, body);
+
+        op = nlambda(pars, body);
+        if (name) {     /* the name is bound around the lambda only */
+                NEW(np);
+                np->name = symp(name);
+                np->argc = argc;
+                np->rands = smalloc((argc+1)*sizeof(*np->rands));
+                for (i = 0; i < argc; i++, vals = cdr(vals))
+                        np->rands[i] = analyze(car(vals));
+                scope = cons(cons(name, null), scope);
+                np->op = analyze(op);
+                scope = cdr(scope);
+                return nevproc(evnamed, np);
+        }
 
-        argv = smalloc(2*sizeof(*argv));
-        op = nlambda(nreverse(pars), body);
-        if (name) {             /* named let */
-                argv[0] = analyze(cons(keywords[DEFINE],
-                                       cons(name, cons(op, null))));
-                op = name;
-        } else
-                argv[0] = NULL;
-        argv[1] = analyze(cons(op, nreverse(vals)));
-
-        return nevproc(evlet, argv);
+        /* the body is evaluated at once, in the current loop if any */
+        lp = chklambda(op);
+        NEW(letp);
+        letp->nvars = argc;
+        letp->vars = smalloc((argc+1)*sizeof(*letp->vars));
+        letp->inits = smalloc((argc+1)*sizeof(*letp->inits));
+        for (i = 0; i < argc; i++, pars = cdr(pars), vals = cdr(vals)) {
+                letp->vars[i] = symp(car(pars));
+                letp->inits[i] = analyze(car(vals));
+        }
+        letp->body = anbody(lp, curloop);
+        letp->size = lp->nlocals;
+        return nevproc(evlet, letp);
 }
 
-/* Analyze the syntax of an application expression. */
+#define nif(test, conseq, alt)                                          \
+        (cons(keywords[IF], cons(test, cons(conseq, cons(alt, null)))))
+
+/* Analyze the syntax of a do expression.
+ * The loop
+ *    (do ((<var> <init> <step>) ...)
+ *        (<test> <expr> ...)
+ *      <command> ...)
+ * is analyzed as the named let
+ *    (let *do* ((<var> <init>) ...)
+ *      (if <test>
+ *          (begin <expr> ...)
+ *          (begin <command> ... (*do* <step> ...))))
+ * except that a variable without step keeps its value.
+ */
 static evproc_t *
-anapp(exp_t *ep)
+ando(exp_t *ep)
 {
-        void **argv;
-        exp_t *p;
-        register int argc;
+        exp_t *bd, *binds, *vars, *inits, *steps, *test, *label, *res;
 
-        if (isunquote(ep) || issplice(ep))
-                anerr("should be in a quasiquote", ep);
-        for (argc = 1, p = ep; ispair(p); p = cdr(p))
-                ++argc;
-        if (!isnull(p))
-                anerr("an application should be a list, given", ep);
-        argv = smalloc(argc*sizeof(*argv));
-        for (argc = 0, p = ep; ispair(p); p = cdr(p))
-                argv[argc++] = analyze(car(p));
-        argv[argc] = NULL;
+        if (isnull(cdr(ep)) || isnull(cddr(ep)) || !ispair(caddr(ep)) ||
+            !islist(cdddr(ep)))
+                anerr("bad syntax in", ep);
+        for (vars = inits = steps = null, binds = cadr(ep);
+             ispair(binds);
+             binds = cdr(binds)) {
+                bd = car(binds);
+                if (!ispair(bd) || !ispair(cdr(bd)) ||
+                    (!isnull(cddr(bd)) &&
+                     (!ispair(cddr(bd)) || !isnull(cdddr(bd)))))
+                        anerr("bad binding syntax", bd);
+                push(car(bd), vars);
+                push(cadr(bd), inits);
+                push(isnull(cddr(bd)) ? car(bd) : caddr(bd), steps);
+        }
+        if (!isnull(binds))
+                anerr("should be a list of bindings", cadr(ep));
+
+        label = atom("*do*");
+        test = caddr(ep);
+        res = isnull(cdr(test)) ? NULL : nseq(cdr(test));
+        steps = cons(label, nreverse(steps));
+        return anloop(label, nreverse(vars), nreverse(inits),
+                      cons(nif(car(test), res,
+                               nseq(nreverse(cons(steps,
+                                                  reverse(cdddr(ep)))))),
+                           null));
+}
 
-        return nevproc(evapp, argv);
+/* Test if the symbol name occurs in the expression. */
+static int
+occurs(exp_t *name, exp_t *ep)
+{
+        for (; ispair(ep); ep = cdr(ep))
+                if (occurs(name, car(ep)))
+                        return 1;
+        return issym(ep) && symp(ep) == symp(name);
 }
 
-static void anqquote1(exp_t *, int , void **, int *);
-static int cunq(exp_t *, int);
+static int istail(exp_t *, int, exp_t *);
 
-/* Analyze the syntax of a quasi-quote expression.
- *
- * We store the expression that serve as a template as the first
- * argument passed to evqquote.  We then traverse the template in
- * depth-first order and stores the analyzed expressions of `unquote'
- * and `unquote-splicing' as remaining arguments.  Their place in the
- * template is then replaced respectively by the variables ``unquote''
- * and ``splice''.  Note that only the ``unquotes'' which are at the
- * same level as the outermost quasi-quote that are concerned here.
- * Each time we enter a quasi-quote, the level is incremented by one
- * and each time we enter an ``unquote'' or ``unquote-splicing'' it's
- * decreased by one.
+/*
+ * Test if every occurrence of name in the sequence lp is the operator
+ * of a call with argc arguments in tail position.
  */
-static evproc_t *
-anqquote(exp_t *ep)
+static int
+tailseq(exp_t *name, int argc, exp_t *lp)
 {
-        void **argv;
-        int argc;
-
-        chklst(ep, 2);
-        if (issplice(cadr(ep)))
-                anerr("syntax error", ep);
-        if (!(argc = cunq(cadr(ep), 1))) /* normal quote */
-                return nevproc(evself, cadr(ep));
-        argv = smalloc((argc+1)*sizeof(*argv));
-        argv[0] = cadr(ep);
-        argc = 1;
-        anqquote1(cadr(ep), 1, argv, &argc);
-        return nevproc(evqquote, argv);
+        for (; ispair(lp) && ispair(cdr(lp)); lp = cdr(lp))
+                if (occurs(name, car(lp)))
+                        return 0;
+        return ispair(lp) ? istail(name, argc, car(lp)) : !occurs(name, lp);
 }
 
-/* Return the number of unquote and unquote-splicing in the expression. */
+/* Same as tailseq for a single expression. */
 static int
-cunq(exp_t *ep, int depth)
+istail(exp_t *name, int argc, exp_t *ep)
 {
-        int count;
-
-        for (count = 0; ispair(ep); ep = cdr(ep)) {
-                if (isqquote(ep)) {
-                        depth++;
-                        ep = cdr(ep);
-                }
-                if (!isunquote(car(ep)) && !issplice(car(ep)))
-                        count += cunq(car(ep), depth);
-                else if (depth == 1)
-                        count++;
-                else
-                        count += cunq(cdar(ep), depth-1);
+        exp_t *p, *cl;
+
+        if (!ispair(ep))
+                return !occurs(name, ep);
+        if (issym(car(ep)) && symp(car(ep)) == symp(name)) {
+                for (p = cdr(ep); ispair(p); p = cdr(p), argc--)
+                        if (occurs(name, car(p)))
+                                return 0;
+                return isnull(p) && argc == 0;
         }
-        return count;
-}
-
-static void
-anqquote1(exp_t *ep, int depth, void **argv, int *argcp)
-{
-        for (; ispair(ep); ep = cdr(ep)) {
-                if (isqquote(ep)) {
-                        depth++;
-                        ep = cdr(ep);
+        if (isif(ep)) {
+                if (!ispair(cdr(ep)) || occurs(name, cadr(ep)))
+                        return 0;
+                for (p = cddr(ep); ispair(p); p = cdr(p))
+                        if (!istail(name, argc, car(p)))
+                                return 0;
+                return !occurs(name, p);
+        }
+        if (isbegin(ep) || isand(ep) || isor(ep))
+                return tailseq(name, argc, cdr(ep));
+        if (iscond(ep)) {
+                for (p = cdr(ep); ispair(p); p = cdr(p)) {
+                        cl = car(p);
+                        if (!ispair(cl) || occurs(name, car(cl)))
+                                return 0;
+                        if (ispair(cdr(cl)) && isarrow(cadr(cl))) {
+                                if (occurs(name, cl))
+                                        return 0;
+                        } else if (!tailseq(name, argc, cdr(cl)))
+                                return 0;
                 }
-                if (!isunquote(car(ep)) && !issplice(car(ep)))
-                        anqquote1(car(ep), depth, argv, argcp);
-                else if (depth == 1) {
-                        chklst(car(ep), 2);
-                        argv[(*argcp)++] = analyze(cadar(ep));
-                        car(ep) = isunquote(car(ep)) ? unquote : splice;
-                } else
-                        anqquote1(cdar(ep), depth-1, argv, argcp);
+                return !occurs(name, p);
+        }
+        if (iscase(ep)) {
+                if (!ispair(cdr(ep)) || occurs(name, cadr(ep)))
+                        return 0;
+                for (p = cddr(ep); ispair(p); p = cdr(p))
+                        if (!ispair(cl = car(p)) || occurs(name, car(cl)) ||
+                            !tailseq(name, argc, cdr(cl)))
+                                return 0;
+                return !occurs(name, p);
         }
+        if (islet(ep) && ispair(cdr(ep)) && !issym(cadr(ep)))
+                return !occurs(name, cadr(ep)) &&
+                        tailseq(name, argc, cddr(ep));
+        if (isreceive(ep) && ispair(cdr(ep)) && ispair(cddr(ep)))
+                return !occurs(name, cadr(ep)) && !occurs(name, caddr(ep)) &&
+                        tailseq(name, argc, cdddr(ep));
+        return !occurs(name, ep);
 }
 
-/* * * * * * * * * * * * * *
- * Evaluation procedures.  *
- * * * * * * * * * * * * * */
-
-static exp_t *
-evself(exp_t *ep, env_t *envp)
+/*
+ * Test if the named let whose label is name can be evaluated as a
+ * loop, i.e. if the label is only used to call itself in tail position.
+ */
+static int
+isloop(exp_t *name, exp_t *pars, exp_t *body)
 {
-        return ep;
-}
+        int argc;
+
+        for (argc = 0; ispair(pars); pars = cdr(pars))
+                argc++;
+        return !(ispair(body) && isdef(car(body))) &&
+                tailseq(name, argc, body);
+}
+
+/*
+ * Return the index of the primitive between lo and hi in intrinsic
+ * bound to the global variable op or -1.
+ */
+static int
+numop(exp_t *op, int lo, int hi)
+{
+        struct nlist *np;
+        int i;
+
+        if (!issym(op) || islocal(symp(op)) ||
+            !(np = lookup(symp(op), globenv)))
+                return -1;
+        for (i = lo; i <= hi; i++)
+                if (np->defn == intrinsic[i])
+                        return i;
+        return -1;
+}
+
+/* Remember that the loop relies on the binding of the operator. */
+static void
+addop(struct loop *lp, exp_t *op)
+{
+        int i;
+
+        for (i = 0; i < lp->nops; i++)
+                if (lp->ops[i] == symp(op))
+                        return;
+        lp->ops = srealloc(lp->ops, (lp->nops+1)*sizeof(*lp->ops));
+        lp->vers = srealloc(lp->vers, (lp->nops+1)*sizeof(*lp->vers));
+        lp->ops[lp->nops] = symp(op);
+        lp->vers[lp->nops++] = atmver(symp(op));
+}
+
+/* Test if the operators of the loop are still bound to their primitive. */
+static inline int
+opsok(struct loop *lp)
+{
+        int i;
+
+        for (i = 0; i < lp->nops; i++)
+                if (atmver(lp->ops[i]) != lp->vers[i])
+                        return 0;
+        return 1;
+}
+
+static int captures(struct loop *, exp_t *, int);
+
+/*
+ * Test if the evaluation of one of the expressions of lst could
+ * capture the frame of the loop.  The last one is in tail position if
+ * tail is set.
+ */
+static int
+capseq(struct loop *lp, exp_t *lst, int tail)
+{
+        for (; ispair(lst); lst = cdr(lst))
+                if (captures(lp, car(lst), tail && isnull(cdr(lst))))
+                        return 1;
+        return 0;
+}
+
+/*
+ * Test if the evaluation of the expression, in the body of the loop
+ * lp, could capture the frame of the loop before it's rebound: by a
+ * procedure created in it, or by a continuation captured by one of
+ * the procedures it calls.  Only the jumps to the loop and the calls
+ * to the intrinsics that don't call a procedure are known not to
+ * capture it, and the loop then relies on the binding of these
+ * intrinsics.  An expression in tail position without jump ends the
+ * loop, so it may capture the frame: the frame isn't rebound after it.
+ */
+static int
+captures(struct loop *lp, exp_t *ep, int tail)
+{
+        exp_t *p, *vars;
+        int c;
+
+        if (!ispair(ep) || isquote(ep) ||
+            (tail && !occurs(atom(lp->name), ep)))
+                return 0;
+        if (islambda(ep) || isdef(ep) ||
+            (islet(ep) && ispair(cdr(ep)) && issym(cadr(ep))))
+                return 1;
+        if (isif(ep)) {
+                if (!ispair(cdr(ep)) || captures(lp, cadr(ep), 0))
+                        return 1;
+                for (p = cddr(ep); ispair(p); p = cdr(p))
+                        if (captures(lp, car(p), tail))
+                                return 1;
+                return 0;
+        }
+        if (iscond(ep) || iscase(ep)) {
+                p = cdr(ep);
+                if (iscase(ep) && (!ispair(p) || captures(lp, car(p), 0)))
+                        return 1;
+                for (p = iscase(ep) ? cdr(p) : p; ispair(p); p = cdr(p))
+                        if (!ispair(car(p)) ||
+                            (iscond(ep) && captures(lp, caar(p), 0)) ||
+                            capseq(lp, cdar(p), tail) ||
+                            (ispair(cdar(p)) && isarrow(cadar(p))))
+                                return 1;
+                return 0;
+        }
+        if (islet(ep) || isdo(ep)) {
+                if (!ispair(cdr(ep)) || (isdo(ep) && !ispair(cddr(ep))))
+                        return 1;
+                for (vars = null, p = cadr(ep); ispair(p); p = cdr(p)) {
+                        if (!ispair(car(p)) || !ispair(cdar(p)) ||
+                            captures(lp, cadar(p), 0))
+                                return 1;
+                        push(caar(p), vars);
+                }
+                scope = cons(vars, scope);
+                if (isdo(ep)) { /* the test, the body and the steps */
+                        c = capseq(lp, caddr(ep), 0) ||
+                                capseq(lp, cdddr(ep), 0);
+                        for (p = cadr(ep); ispair(p) && !c; p = cdr(p))
+                                c = capseq(lp, cddar(p), 0);
+                } else
+                        c = capseq(lp, cddr(ep), tail);
+                scope = cdr(scope);
+                return c;
+        }
+        if (isbegin(ep) || isand(ep) || isor(ep))
+                return capseq(lp, cdr(ep), tail);
+        if ((issym(car(ep)) && atmsyn(symp(car(ep)))) ||
+            (issym(car(ep)) && symp(car(ep)) == lp->name &&
+             !islocal(lp->name)))
+                return capseq(lp, cdr(ep), 0);  /* other form or jump */
+        if (numop(car(ep), PADD, PVALUES) < 0)
+                return 1;
+        addop(lp, car(ep));
+        return capseq(lp, cdr(ep), 0);
+}
+
+static int usesn(struct loop *, exp_t *, int, exp_t *, int);
+
+/*
+ * Test if the value of the variable v, the loop variable of index
+ * idx, can't escape from the expression ep.  It can only be an operand
+ * of an arithmetic primitive, the new value of itself in a call to the
+ * label of the loop or, if tail is set, the value of the expression.
+ */
+static int
+usesn(struct loop *lp, exp_t *v, int idx, exp_t *ep, int tail)
+{
+        exp_t *p, *vars;
+        int i, ok;
+
+        if (!ispair(ep))
+                return !issym(ep) || symp(ep) != symp(v) || tail;
+        if (!occurs(v, ep))
+                return 1;
+        if (isif(ep)) {
+                if (!usesn(lp, v, idx, cadr(ep), 0))
+                        return 0;
+                for (p = cddr(ep); ispair(p); p = cdr(p))
+                        if (!usesn(lp, v, idx, car(p), tail))
+                                return 0;
+                return 1;
+        }
+        if (isbegin(ep)) {
+                for (p = cdr(ep); ispair(p); p = cdr(p))
+                        if (!usesn(lp, v, idx, car(p), tail && isnull(cdr(p))))
+                                return 0;
+                return 1;
+        }
+        if (iscond(ep)) {
+                for (p = cdr(ep); ispair(p); p = cdr(p)) {
+                        if (!ispair(car(p)) || (ispair(cdar(p)) &&
+                                                isarrow(cadar(p))))
+                                return 0;
+                        if (!iselse(caar(p)) && !usesn(lp, v, idx, caar(p), 0))
+                                return 0;
+                        if (!usesn(lp, v, idx, nseq(cdar(p)), tail))
+                                return 0;
+                }
+                return 1;
+        }
+        if (islet(ep) && ispair(cdr(ep)) && !issym(cadr(ep))) {
+                for (vars = null, p = cadr(ep); ispair(p); p = cdr(p)) {
+                        if (!ispair(car(p)) || !ispair(cdar(p)) ||
+                            !usesn(lp, v, idx, cadar(p), 0))
+                                return 0;
+                        if (symp(caar(p)) == symp(v))
+                                return 0;
+                        push(caar(p), vars);
+                }
+                scope = cons(vars, scope);
+                ok = usesn(lp, v, idx, nseq(cddr(ep)), tail);
+                scope = cdr(scope);
+                return ok;
+        }
+        if (issym(car(ep)) && symp(car(ep)) == lp->name &&
+            !islocal(lp->name)) {
+                for (i = 0, p = cdr(ep); ispair(p); p = cdr(p), i++)
+                        if (!(i == idx && issym(car(p))) &&
+                            !usesn(lp, v, idx, car(p), 0))
+                                return 0;
+                return 1;
+        }
+        if (issym(car(ep)) && atmsyn(symp(car(ep))))
+                return 0;       /* any other special form */
+        if (numop(car(ep), PADD, PGT) >= 0 && ispair(cdr(ep)) &&
+            ispair(cddr(ep)) && isnull(cdddr(ep))) {
+                addop(lp, car(ep));
+                for (p = cdr(ep); ispair(p); p = cdr(p))
+                        if (!issym(car(p)) && !usesn(lp, v, idx, car(p), 0))
+                                return 0;
+                return 1;
+        }
+        for (p = ep; ispair(p); p = cdr(p))
+                if (!usesn(lp, v, idx, car(p), 0))
+                        return 0;
+        return 1;
+}
+
+/* Return the type of a numeric expression of the loop or TANY. */
+static int
+ntype(struct loop *lp, exp_t *ep)
+{
+        int i, a, b;
+
+        if (isfxn(ep))
+                return TFXN;
+        if (isfloat(ep))
+                return TFLT;
+        if (issym(ep)) {
+                for (i = 0; i < lp->nvars; i++)
+                        if (lp->vars[i] == symp(ep))
+                                return lp->types[i];
+                return 0;       /* checked at run time */
+        }
+        if (!ispair(ep) || numop(car(ep), PADD, PPROD) < 0 ||
+            !ispair(cdr(ep)) || !ispair(cddr(ep)) || !isnull(cdddr(ep)))
+                return TANY;
+        a = ntype(lp, cadr(ep));
+        b = ntype(lp, caddr(ep));
+        return a == 0 ? b : (b == 0 || a == b ? a : TANY);
+}
+
+/* Add the types of the new values of the variables in the jumps of ep. */
+static int
+infer(struct loop *lp, exp_t *ep)
+{
+        exp_t *p;
+        int i, t, changed;
+
+        if (!ispair(ep) || isquote(ep))
+                return 0;
+        changed = 0;
+        if (issym(car(ep)) && symp(car(ep)) == lp->name)
+                for (i = 0, p = cdr(ep); ispair(p) && i < lp->nvars;
+                     p = cdr(p), i++) {
+                        t = ntype(lp, car(p));
+                        if (lp->types[i] == 0 && t != 0)
+                                changed = lp->types[i] = t;
+                        else if (t != 0 && t != lp->types[i] &&
+                                 lp->types[i] != TANY)
+                                changed = lp->types[i] = TANY;
+                }
+        for (p = ep; ispair(p); p = cdr(p))
+                changed |= infer(lp, car(p));
+        return changed;
+}
+
+/*
+ * Infer the types of the variables of a loop whose values are only
+ * fixnums or only floats.  Their new values are then computed by the
+ * jumps without allocating the intermediate results (see antnum).
+ * The value of a variable which can't escape from the body is also
+ * owned by the loop, which updates it in place instead of allocating
+ * a new number at each iteration, unless the body could capture the
+ * frame.  This remains valid as long as the arithmetic operators keep
+ * their original binding.
+ */
+static void
+antypes(struct loop *lp, exp_t *inits, exp_t *body)
+{
+        exp_t *p;
+        int i;
+
+        lp->types = scalloc(lp->nvars+1, sizeof(*lp->types));
+        lp->owned = scalloc(lp->nvars+1, sizeof(*lp->owned));
+        for (i = 0, p = inits; i < lp->nvars; i++, p = cdr(p))
+                lp->types[i] = isfxn(car(p)) ? TFXN :
+                        (isfloat(car(p)) ? TFLT : 0);
+        while (infer(lp, nseq(body)))
+                ;
+        for (i = 0; i < lp->nvars; i++) {
+                if (lp->types[i] == 0)  /* checked at run time */
+                        lp->types[i] = TFXN;
+                if (lp->types[i] != TANY && !lp->fresh)
+                        lp->owned[i] = usesn(lp, atom(lp->vars[i]), i,
+                                             nseq(body), 1);
+        }
+}
+
+/*
+ * Analyze a loop labeled by name.  The variables are bound to the
+ * initial values in a new frame and the body is evaluated repeatedly.
+ * The calls to the label in the body are analyzed by anjump: they
+ * store the new values of the variables and return to evloop which
+ * rebinds them in place.  A new frame is only created at each
+ * iteration if the body could capture it (see captures).
+ */
+static evproc_t *
+anloop(exp_t *name, exp_t *vars, exp_t *inits, exp_t *body)
+{
+        struct loop *lp, *outer;
+        exp_t *p, *inits0;
+        int i;
+
+        chkpars(vars);
+        inits0 = inits;
+        NEW(lp);
+        lp->name = symp(name);
+        for (lp->nvars = 0, p = vars; ispair(p); p = cdr(p))
+                lp->nvars++;
+        lp->vars = smalloc(lp->nvars*sizeof(*lp->vars));
+        lp->inits = smalloc(lp->nvars*sizeof(*lp->inits));
+        for (i = 0, p = vars; ispair(p); p = cdr(p), inits = cdr(inits)) {
+                lp->vars[i] = symp(car(p));
+                lp->inits[i++] = analyze(car(inits));
+        }
+        lp->nops = 0;
+        lp->ops = NULL;
+        lp->vers = NULL;
+
+        outer = curloop;
+        curloop = lp;
+        scope = cons(vars, scope);
+        lp->fresh = capseq(lp, body, 1);
+        antypes(lp, inits0, body);
+        lp->body = anbegin(nseq(body));
+        scope = cdr(scope);
+        curloop = outer;
+
+        return nevproc(evloop, lp);
+}
+
+static exp_t **jmpargs;         /* new values of the loop variables */
+static double *jmpnums;         /* or their numeric value */
+static int jmpsize;             /* size of jmpargs */
+
+/* Return the numeric computation of ep in the current loop or NULL. */
+static struct tnum *
+antnum(exp_t *ep)
+{
+        struct tnum *tp;
+        int op;
+
+        if (isfxn(ep) || isfloat(ep) || issym(ep)) {
+                NEW(tp);
+                tp->op = -1;
+                tp->leaf = analyze(ep);
+                return tp;
+        }
+        if (!ispair(ep) || (op = numop(car(ep), PADD, PPROD)) < 0 ||
+            !ispair(cdr(ep)) || !ispair(cddr(ep)) || !isnull(cdddr(ep)))
+                return NULL;
+        NEW(tp);
+        tp->op = op;
+        tp->leaf = NULL;
+        if (!(tp->rand[0] = antnum(cadr(ep))) ||
+            !(tp->rand[1] = antnum(caddr(ep))))
+                return NULL;
+        addop(curloop, car(ep));
+        return tp;
+}
+
+/* Analyze a call to the label of the current loop. */
+static evproc_t *
+anjump(exp_t *ep)
+{
+        struct jump *jp;
+        int argc, i;
+
+        argc = curloop->nvars;
+        if (argc > jmpsize) {
+                jmpargs = srealloc(jmpargs, argc*sizeof(*jmpargs));
+                jmpnums = srealloc(jmpnums, argc*sizeof(*jmpnums));
+                jmpsize = argc;
+        }
+        NEW(jp);
+        jp->loop = curloop;
+        jp->args = smalloc((argc+1)*sizeof(*jp->args));
+        jp->steps = smalloc((argc+1)*sizeof(*jp->steps));
+        for (i = 0, ep = cdr(ep); ispair(ep); ep = cdr(ep), i++) {
+                jp->args[i] = analyze(car(ep));
+                jp->steps[i] = curloop->types[i] == TFXN ||
+                        curloop->types[i] == TFLT ? antnum(car(ep)) : NULL;
+        }
+        return nevproc(evjump, jp);
+}
+
+/*
+ * Return an application to two operands.  The node records the types
+ * of the operands passed to an arithmetic primitive.  Once it has
+ * only seen fixnums or only floats, it's rewritten into a node
+ * specialized for them (see evbinapp).
+ */
+static evproc_t *
+nbinapp(evproc_t *op, evproc_t *a, evproc_t *b)
+{
+        struct binapp *bp;
+
+        NEW(bp);
+        bp->op = op;
+        bp->rand[0] = a;
+        bp->rand[1] = b;
+        bp->prim = NULL;
+        bp->seen = 0;
+        bp->count = 0;
+        return bp->self = nevproc(evbinapp, bp);
+}
+
+/* Return an application of op to the argc operands in rands. */
+static evproc_t *
+napp(evproc_t *op, int argc, evproc_t **rands)
+{
+        evproc_t **argv;
+
+        if (argc == 2)
+                return nbinapp(op, rands[0], rands[1]);
+        argv = smalloc((argc+2)*sizeof(*argv));
+        argv[0] = op;
+        memcpy(argv+1, rands, argc*sizeof(*rands));
+        argv[argc+1] = NULL;
+        return nevproc(evapp, argv);
+}
+
+/*
+ * Analyze an application of an intrinsic if the operator is a global
+ * variable bound to it.  The operation is then inlined as long as the
+ * variable isn't defined or assigned again.  Return NULL otherwise.
+ */
+static evproc_t *
+anprim(exp_t *ep, int argc)
+{
+        exp_t *(*eval)();
+        struct nlist *np;
+        struct prim *pp;
+        int i;
+
+        if (!issym(car(ep)) || islocal(symp(car(ep))) ||
+            !(np = lookup(symp(car(ep)), globenv)))
+                return NULL;
+        for (i = 0; i < NINTRINSICS && np->defn != intrinsic[i]; i++)
+                ;
+        switch (i) {
+        case PCAR:
+                eval = evcar;
+                break;
+        case PCDR:
+                eval = evcdr;
+                break;
+        case PCONS:
+                eval = evcons;
+                break;
+        case PEQ:
+                eval = eveq;
+                break;
+        case PADD:
+                eval = evadd;
+                break;
+        case PLT:
+                eval = evlt;
+                break;
+        default:
+                return NULL;
+        }
+        if (argc != (i == PCAR || i == PCDR ? 1 : 2))
+                return NULL;
+
+        NEW(pp);
+        pp->name = symp(car(ep));
+        pp->ver = atmver(pp->name);
+        pp->app = analyze(car(ep));
+        pp->rand[0] = analyze(cadr(ep));
+        pp->rand[1] = argc == 2 ? analyze(caddr(ep)) : NULL;
+        pp->app = napp(pp->app, argc, pp->rand);
+        return nevproc(eval, pp);
+}
+
+/*
+ * Return the index in libproc of the procedure bound to the global
+ * variable op or -1.
+ */
+static int
+libindex(exp_t *op)
+{
+        struct nlist *np;
+        int i;
+
+        if (!issym(op) || islocal(symp(op)) ||
+            !(np = lookup(symp(op), globenv)))
+                return -1;
+        for (i = 0; i < NLIBPROCS && np->defn != libproc[i]; i++)
+                ;
+        return i < NLIBPROCS ? i : -1;
+}
+
+/*
+ * Return the number of operands of the application ep if it's a call
+ * to a stage of a fused chain, that is map, reverse or, for the
+ * outermost one, a fold.  Return -1 otherwise.
+ */
+static int
+isstage(exp_t *ep, int outer)
+{
+        static const int arity[NLIBPROCS] = { 2, 3, 3, 1, -1 };
+        exp_t *p;
+        int i, argc;
+
+        if (!ispair(ep) || (i = libindex(car(ep))) < 0 || i == LAPPEND ||
+            (!outer && i != LMAP && i != LREVERSE))
+                return -1;
+        for (argc = 0, p = cdr(ep); ispair(p); p = cdr(p))
+                argc++;
+        return isnull(p) && argc == arity[i] ? argc : -1;
+}
+
+/*
+ * Analyze a chain of applications of map, reverse, foldl and foldr
+ * whose operators are global variables bound to the procedures of the
+ * library, like (foldl + 0 (map f (reverse l))).  The elements then
+ * go from one stage to the next without building the intermediate
+ * lists, as long as none of the variables is defined or assigned
+ * again.  The source may be an application of append to one or more
+ * lists, which are traversed in sequence.  Return NULL if ep isn't
+ * such an application.
+ */
+static evproc_t *
+anfuse(exp_t *ep, int argc)
+{
+        struct fuse *fp;
+        struct stage *sp;
+        evproc_t *rands[3];
+        exp_t *p, *q;
+        int n, i;
+
+        if (isstage(ep, 1) < 0)
+                return NULL;
+        for (n = 0, p = ep; isstage(p, n == 0) >= 0; p = car(q), n++)
+                for (q = cdr(p); ispair(cdr(q)); q = cdr(q))
+                        ;
+        if (ispair(p) && libindex(car(p)) == LAPPEND && isnull(cdr(p)))
+                return NULL;    /* nothing to traverse */
+
+        NEW(fp);
+        fp->nstage = n;
+        fp->stages = smalloc(n*sizeof(*fp->stages));
+        for (i = 0, p = ep; i < n; i++) {
+                sp = fp->stages+i;
+                sp->op = libindex(car(p));
+                sp->name = symp(car(p));
+                sp->ver = atmver(sp->name);
+                sp->proc = sp->op != LREVERSE ? analyze(cadr(p)) : NULL;
+                sp->init = sp->op == LFOLDL || sp->op == LFOLDR ?
+                        analyze(caddr(p)) : NULL;
+                for (q = cdr(p); ispair(cdr(q)); q = cdr(q))
+                        ;
+                p = car(q);
+        }
+        fp->name = NULL;
+        fp->nsrc = 1;
+        if (ispair(p) && libindex(car(p)) == LAPPEND && islist(cdr(p))) {
+                fp->name = symp(car(p));
+                fp->ver = atmver(fp->name);
+                for (fp->nsrc = 0, q = cdr(p); ispair(q); q = cdr(q))
+                        fp->nsrc++;
+        }
+        fp->srcs = smalloc(fp->nsrc*sizeof(*fp->srcs));
+        if (fp->name == NULL)
+                fp->srcs[0] = analyze(p);
+        else
+                for (i = 0, q = cdr(p); ispair(q); q = cdr(q))
+                        fp->srcs[i++] = analyze(car(q));
+
+        /* the applications without fusion share the same operands */
+        fp->app = fp->name == NULL ? fp->srcs[0] :
+                napp(analyze(car(p)), fp->nsrc, fp->srcs);
+        for (i = n-1; i >= 0; i--) {
+                sp = fp->stages+i;
+                argc = 0;
+                if (sp->proc)
+                        rands[argc++] = sp->proc;
+                if (sp->init)
+                        rands[argc++] = sp->init;
+                rands[argc++] = fp->app;
+                fp->app = napp(nevproc(evvar, atom(sp->name)),
+                               argc, rands);
+        }
+        return nevproc(evfuse, fp);
+}
+
+#define INLINESIZE      16      /* maximum number of pairs in an inlined body */
+
+/* Return the number of pairs in ep, stopping past max. */
+static int
+npairs(exp_t *ep, int max)
+{
+        int n;
+
+        for (n = 0; ispair(ep) && n <= max; ep = cdr(ep))
+                n += 1 + npairs(car(ep), max-n);
+        return n;
+}
+
+/*
+ * Return the lambda of the procedure op named name if it can be
+ * inlined in a call with argc arguments, NULL otherwise.  It must be
+ * a small function of the global environment with a fixed number of
+ * parameters, without internal definitions and which doesn't call
+ * itself.
+ */
+static struct lambda *
+inlinable(exp_t *op, symb_t *name, int argc)
+{
+        struct lambda *lp;
+        exp_t *p;
+        int n;
+
+        if (!isproc(op) || ptype(op) != FUNC || fenv(op) != globenv)
+                return NULL;
+        lp = flam(op);
+        if (lp->body == NULL)   /* compiled expression */
+                return NULL;
+        for (n = 0, p = lp->parp; ispair(p); p = cdr(p))
+                n++;
+        if (!isnull(p) || n != argc || npairs(lp->body, INLINESIZE) >
+            INLINESIZE || occurs(atom(name), lp->body))
+                return NULL;
+        for (p = lp->body; ispair(p); p = cdr(p))
+                if (isdef(car(p)))
+                        return NULL;
+        return lp;
+}
+
+/*
+ * Analyze a call to a global variable bound to a small procedure.  The
+ * body of the procedure is then evaluated directly in a frame binding
+ * the operands, without the procedure object, the list of arguments
+ * and the checks of apply.  Whenever the variable is defined or
+ * assigned, the call is linked again to its new value.  Return NULL
+ * if the operator isn't bound to such a procedure.
+ */
+static evproc_t *
+aninline(exp_t *ep, int argc)
+{
+        struct nlist *np;
+        struct inl *ip;
+        exp_t *p;
+        int i;
+
+        if (!issym(car(ep)) || islocal(symp(car(ep))) ||
+            !(np = lookup(symp(car(ep)), globenv)) ||
+            !inlinable(np->defn, symp(car(ep)), argc))
+                return NULL;
+
+        NEW(ip);
+        ip->name = symp(car(ep));
+        ip->ver = atmver(ip->name);
+        ip->lamp = flam(np->defn);
+        ip->argc = argc;
+        ip->rands = smalloc((argc+1)*sizeof(*ip->rands));
+        for (i = 0, p = cdr(ep); i < argc; i++, p = cdr(p))
+                ip->rands[i] = analyze(car(p));
+        ip->op = analyze(car(ep));
+        return nevproc(evinline, ip);
+}
+
+/*
+ * Analyze a call to values if the operator is a global variable bound
+ * to it.  The operands are then stored directly in the registers
+ * without building the list of arguments.  Return NULL otherwise.
+ */
+static evproc_t *
+anvalues(exp_t *ep, int argc)
+{
+        struct vals *vp;
+        exp_t *p;
+        int i;
+
+        if (numop(car(ep), PVALUES, PVALUES) < 0)
+                return NULL;
+        NEW(vp);
+        vp->name = symp(car(ep));
+        vp->ver = atmver(vp->name);
+        vp->argc = argc;
+        vp->rands = smalloc((argc+1)*sizeof(*vp->rands));
+        for (i = 0, p = cdr(ep); i < argc; i++, p = cdr(p))
+                vp->rands[i] = analyze(car(p));
+        vp->app = ancall(ep, argc);
+        return nevproc(evvalues, vp);
+}
+
+/* Return the lambda of the consumer ep if it's a lambda expression. */
+static struct lambda *
+anconsumer(exp_t *ep)
+{
+        struct lambda *lp;
+
+        if (!islambda(ep))
+                return NULL;
+        lp = chklambda(ep);
+        anbody(lp, curloop);
+        return lp;
+}
+
+/*
+ * Analyze the syntax of a receive expression.
+ *    (receive <formals> <expr> <body>)
+ * binds the values of <expr> to <formals> like the parameters of a
+ * lambda expression, and evaluates <body> in the new frame.
+ */
+static evproc_t *
+anrecv(exp_t *ep)
+{
+        struct recv *rp;
+
+        if (!ispair(cdr(ep)) || !ispair(cddr(ep)) || !ispair(cdddr(ep)))
+                anerr("bad syntax in", ep);
+        NEW(rp);
+        rp->name = NULL;
+        rp->prod = analyze(caddr(ep));
+        rp->thunk = 0;
+        rp->lamp = anconsumer(cons(keywords[LAMBDA],
+                                   cons(cadr(ep), cdddr(ep))));
+        rp->cons = NULL;
+        rp->app = NULL;
+        return nevproc(evrecv, rp);
+}
+
+/*
+ * Analyze a call to call-with-values if the operator is a global
+ * variable bound to it.  A producer without parameters written as a
+ * lambda expression is evaluated in place, and a consumer written as
+ * a lambda expression receives the values like a receive expression.
+ * Return NULL otherwise.
+ */
+static evproc_t *
+ancallvals(exp_t *ep, int argc)
+{
+        struct recv *rp;
+        exp_t *prod;
+
+        if (argc != 2 || numop(car(ep), PCALLVALS, PCALLVALS) < 0)
+                return NULL;
+        NEW(rp);
+        rp->name = symp(car(ep));
+        rp->ver = atmver(rp->name);
+        prod = cadr(ep);
+        if (islambda(prod) && ispair(cdr(prod)) && isnull(cadr(prod)) &&
+            ispair(cddr(prod))) {
+                rp->prod = analyze(cons(keywords[LET], cdr(prod)));
+                rp->thunk = 0;
+        } else {
+                rp->prod = analyze(prod);
+                rp->thunk = 1;
+        }
+        rp->lamp = anconsumer(caddr(ep));
+        rp->cons = rp->lamp ? NULL : analyze(caddr(ep));
+        rp->app = ancall(ep, argc);
+        return nevproc(evrecv, rp);
+}
+
+/*
+ * Analyze the syntax of a module definition.
+ *    (define-module <name> (export <var> ...) <body>)
+ * The import expressions of the body are evaluated first.  The rest
+ * is analyzed like the body of a lambda expression without parameters
+ * so that its definitions are local to the module.  It returns the
+ * list of the values of the exported variables.
+ */
+static evproc_t *
+anmodule(exp_t *ep)
+{
+        struct module *mp;
+        exp_t *p, *q, *body, *vals, *imps;
+
+        if (!ispair(cdr(ep)) || !issym(cadr(ep)) || !ispair(cddr(ep)) ||
+            !ispair(caddr(ep)) || !iseq(car(caddr(ep)), keywords[EXPORT]))
+                anerr("bad syntax in", ep);
+        for (vals = null, p = cdr(caddr(ep)); ispair(p); p = cdr(p)) {
+                if (!issym(car(p)))
+                        anerr("should be a symbol", car(p));
+                push(cons(keywords[UNQUOTE], cons(car(p), null)), vals);
+        }
+        if (!isnull(p))
+                anerr("should be a list of variables", caddr(ep));
+        for (body = imps = null, p = cdddr(ep); ispair(p); p = cdr(p))
+                if (isimport(car(p))) {
+                        analyze(car(p));        /* check its syntax */
+                        for (q = cdar(p); ispair(q); q = cdr(q))
+                                push(car(q), imps);
+                } else
+                        push(car(p), body);
+        push(cons(keywords[QQUOTE], cons(nreverse(vals), null)), body);
+
+        NEW(mp);
+        mp->name = symp(cadr(ep));
+        mp->exports = cdr(caddr(ep));
+        mp->imports = nreverse(imps);
+        mp->lamp = chklambda(nlambda(null, nreverse(body)));
+        mp->vals = NULL;
+        mp->next = NULL;
+        return nevproc(evmodule, mp);
+}
+
+/*
+ * Analyze the syntax of an import expression.
+ *    (import <name> ...)
+ */
+static evproc_t *
+animport(exp_t *ep)
+{
+        exp_t *p;
+
+        for (p = cdr(ep); ispair(p); p = cdr(p))
+                if (!issym(car(p)))
+                        anerr("should be the name of a module", car(p));
+        if (!isnull(p))
+                anerr("bad syntax in", ep);
+        return nevproc(evimport, cdr(ep));
+}
+
+/* Analyze the syntax of an application expression. */
+static evproc_t *
+anapp(exp_t *ep)
+{
+        evproc_t *epp;
+        exp_t *p;
+        register int argc;
+
+        if (isunquote(ep) || issplice(ep))
+                anerr("should be in a quasiquote", ep);
+        if (curloop && issym(car(ep)) && symp(car(ep)) == curloop->name)
+                return anjump(ep);
+        for (argc = 0, p = cdr(ep); ispair(p); p = cdr(p))
+                ++argc;
+        if (!isnull(p))
+                anerr("an application should be a list, given", ep);
+        if ((epp = anprim(ep, argc)) != NULL ||
+            (epp = anfuse(ep, argc)) != NULL ||
+            (epp = aninline(ep, argc)) != NULL ||
+            (epp = anvalues(ep, argc)) != NULL ||
+            (epp = ancallvals(ep, argc)) != NULL)
+                return epp;
+        return ancall(ep, argc);
+}
+
+/* Analyze a call of the operator of ep to argc operands. */
+static evproc_t *
+ancall(exp_t *ep, int argc)
+{
+        evproc_t *op, *rands[argc+1];
+        int i;
+
+        op = analyze(car(ep));
+        for (i = 0, ep = cdr(ep); i < argc; i++, ep = cdr(ep))
+                rands[i] = analyze(car(ep));
+        return napp(op, argc, rands);
+}
+
+static evproc_t *anqq(exp_t *, int);
+
+/*
+ * Analyze the syntax of a quasi-quote expression.
+ *
+ * The template is compiled into a tree of evaluation procedures that
+ * only builds the pairs leading to an `unquote' or `unquote-splicing'
+ * of the same level as the outermost quasi-quote.  The subtrees
+ * without such expressions are constants shared with the template.
+ * Each time we enter a quasi-quote, the level is incremented by one
+ * and each time we enter an ``unquote'' or ``unquote-splicing'' it's
+ * decreased by one.
+ */
+static evproc_t *
+anqquote(exp_t *ep)
+{
+        evproc_t *pp;
+
+        chklst(ep, 2);
+        if (issplice(cadr(ep)))
+                anerr("syntax error", ep);
+        if ((pp = anqq(cadr(ep), 1)) == NULL) /* normal quote */
+                return nevproc(evself, cadr(ep));
+        return pp;
+}
+
+/*
+ * Return the evaluation procedure of the template at the given level
+ * or NULL if the template is a constant.
+ */
+static evproc_t *
+anqq(exp_t *tp, int depth)
+{
+        evproc_t **argv, *car, *cdr;
+
+        if (!ispair(tp))
+                return NULL;
+        if (isunquote(tp) || issplice(tp)) {
+                chklst(tp, 2);
+                if (depth == 1 && issplice(tp))
+                        anerr("should be inside a list", tp);
+                if (depth-- == 1)
+                        return analyze(cadr(tp));
+        } else if (isqquote(tp))
+                depth++;
+        if (issplice(car(tp)) && depth == 1) {
+                chklst(car(tp), 2);
+                car = analyze(cadar(tp));
+                if ((cdr = anqq(cdr(tp), depth)) == NULL)
+                        cdr = nevproc(evself, cdr(tp));
+                argv = smalloc(2*sizeof(*argv));
+                argv[0] = car;
+                argv[1] = cdr;
+                return nevproc(evsplice, argv);
+        }
+        car = anqq(car(tp), depth);
+        cdr = anqq(cdr(tp), depth);
+        if (car == NULL && cdr == NULL)
+                return NULL;
+        argv = smalloc(2*sizeof(*argv));
+        argv[0] = car ? car : nevproc(evself, car(tp));
+        argv[1] = cdr ? cdr : nevproc(evself, cdr(tp));
+        return nevproc(evqcons, argv);
+}
+
+/* * * * * * * * * * * * * *
+ * Evaluation procedures.  *
+ * * * * * * * * * * * * * */
+
+static exp_t *
+evself(exp_t *ep, env_t *envp)
+{
+        return ep;
+}
 
 /* Return the value of a variable if any. */
 static exp_t *
-evvar(exp_t *var, env_t *envp)
+evvar(exp_t *var, env_t *envp)
+{
+        struct nlist *np;
+
+        if (!(np = lookup(symp(var), envp)) || np->defn == undefined)
+                everr("unbound variable", var);
+        return np->defn;
+}
+
+/* Return the value of an imported variable found at analysis. */
+static exp_t *
+evimpvar(exp_t **argv, env_t *envp)
+{
+        return argv[0];
+}
+
+#define valerr(var) RAISE1(eval_error,                                       \
+                           "the expression assigned to %s returns no value", \
+                           var)
+
+/* Evaluate a define expression */
+static exp_t *
+evdef(void **argv, env_t *envp)
+{
+        symb_t *var;
+        evproc_t *vproc;
+        exp_t *val;
+
+        var = (symb_t *)argv[0];
+        vproc = (evproc_t *)argv[1];
+        if (atmimp(var) && envp == globenv)
+                everr("can't redefine the imported variable", atom(var));
+	if (!(val = single(evproc(vproc, envp))))
+                valerr(var);
+        if (type(val) == PROC && label(val) == NULL)
+                label(val) = strtoatm(var); /* label anonymous procedure */
+        ccstore(val);
+        install(var, val, envp);
+        atmver(var)++;
+
+        return NULL;
+}
+
+/* Evaluate a set! expression. */
+static exp_t *
+evset(void **argv, env_t *envp)
+{
+        exp_t *var, *val;
+        struct nlist *np;
+
+        var = argv[0];
+        if (!(val = single(evproc((evproc_t *)argv[1], envp))))
+                valerr(symp(var));
+        if (!(np = lookup(symp(var), envp)))
+                everr("unbound variable", var);
+        if (atmimp(symp(var)) && np == lookup(symp(var), globenv))
+                everr("can't assign the imported variable", var);
+        ccstore(val);
+        np->defn = val;
+        atmver(symp(var))++;
+        return NULL;
+}
+
+/* Set the car or the cdr of an expression to a new value. */
+static exp_t *
+evsetpair(evproc_t **argv, env_t *envp)
+{
+        exp_t *var, *val;
+
+        if (!ispair(var = evproc(argv[1], envp)))
+                everr("should be a pair", var);
+        if (!(val = single(evproc(argv[2], envp))))
+                valerr(symp(var));
+        ccstore(val);
+        if ((place_t)argv[0] == CAR)
+                car(var) = val;
+        else
+                cdr(var) = val;
+        return NULL;
+}
+
+/* Evaluate an if expression */
+static exp_t *
+evif(evproc_t **argv, env_t *envp)
+{
+        evproc_t *pred, *res;
+
+        pred = argv[0];
+        res = (!iseq(false, single(evproc(pred, envp))) ? argv[1] : argv[2]);
+        return evproc(res, envp);
+}
+
+/* Evaluate a begin expression */
+static exp_t *
+evbegin(evproc_t **argv, env_t *envp)
+{
+        for (; *(argv+1); argv++)
+                evproc(argv[0], envp);
+        return evproc(argv[0], envp);
+}
+
+/* Evaluate a cond expression */
+static exp_t *
+evcond(evproc_t **argv, env_t *envp)
+{
+        exp_t *b;
+
+        for (; *argv; argv += 2)
+                if (iselse(*argv) ||
+                    !iseq(false, b = single(evproc(*argv, envp))))
+                        return isarrow(*(argv+1)) ?
+                                apply(evproc(*(argv+2), envp),
+                                      cons(single(b), null)) :
+                                evproc(*(argv+1), envp);
+                else if (isarrow(*(argv+1)))
+                        ++argv;
+
+        return NULL;
+}
+
+/* Evaluate a case expression */
+static exp_t *
+evcase(struct dispatch *dp, env_t *envp)
+{
+        exp_t *key, *p;
+        int i, index;
+
+        key = single(evproc(dp->key, envp));
+        index = 0;
+        if (dp->table && isfxn(key) && dp->ttype == FIXNUM) {
+                if ((i = fixnum(key) - dp->lo) >= 0 && i < dp->size)
+                        index = dp->table[i];
+        } else if (dp->table && ischar(key) && dp->ttype == CHAR) {
+                if ((i = char(key) - dp->lo) >= 0 && i < dp->size)
+                        index = dp->table[i];
+        } else if (isfxn(key) || ischar(key) || isatom(key) || isbool(key))
+                index = hfind(dp, key)->index;
+        else if (israt(key) || isfloat(key))
+                for (p = dp->numbers; !isnull(p); p = cdr(p))
+                        if (type(caar(p)) == type(key) &&
+                            (isfloat(key) ? flt(key) == flt(caar(p)) :
+                             num(key) == num(caar(p)) &&
+                             den(key) == den(caar(p)))) {
+                                index = fixnum(cdar(p));
+                                break;
+                        }
+        if (index)
+                return evproc(dp->clauses[index-1], envp);
+        return dp->otherwise ? evproc(dp->otherwise, envp) : NULL;
+}
+
+/* Evaluate an `and' expression */
+static exp_t *
+evand(evproc_t **argv, env_t *envp)
+{
+        exp_t *pred;
+
+        for (; *argv && *(argv+1); argv++)
+                if (iseq(false, pred = single(evproc(*argv, envp))))
+                        return pred;
+        return *argv ? evproc(*argv, envp) : true;
+}
+
+/* Evaluate an `or' expression */
+static exp_t *
+evor(evproc_t **argv, env_t *envp)
+{
+        exp_t *pred;
+
+        for (; *argv && *(argv+1); argv++)
+                if (!iseq(false, pred = single(evproc(*argv, envp))))
+                        return pred;
+        return *argv ? evproc(*argv, envp) : false;
+}
+
+/* Evaluate a lambda expression */
+static exp_t *
+evlambda(struct lambda *lp, env_t *envp)
+{
+        return nproc(nfunc(lp, envp));
+}
+
+/*
+ * Eval a let expression.  The initial values are bound directly in a
+ * new frame, without building a procedure and its arguments.
+ */
+static exp_t *
+evlet(struct let *lp, env_t *envp)
+{
+        exp_t *vals[lp->nvars+1];
+        env_t *ep;
+        int i;
+
+        for (i = 0; i < lp->nvars; i++)
+                vals[i] = single(evproc(lp->inits[i], envp));
+        ep = extsize(lp->size, envp);
+        for (i = 0; i < lp->nvars; i++)
+                install(lp->vars[i], vals[i], ep);
+        return evproc(lp->body, ep);
+}
+
+/* Bind the internal definitions of a body and evaluate the rest. */
+static exp_t *
+evbody(struct body *bp, env_t *envp)
+{
+        struct nlist *binds[bp->ndefs];
+        exp_t *val;
+        int i;
+
+        for (i = 0; i < bp->ndefs; i++)
+                binds[i] = install(bp->vars[i], undefined, envp);
+        for (i = 0; i < bp->ndefs; i++) {
+                if (!(val = single(evproc(bp->vals[i], envp))))
+                        valerr(bp->vars[i]);
+                if (type(val) == PROC && label(val) == NULL)
+                        label(val) = bp->vars[i];
+                binds[i]->defn = val;
+        }
+        return evproc(bp->rest, envp);
+}
+
+/* Eval a named let expression: bind the procedure in a new frame
+ * and call it on the initial values. */
+static exp_t *
+evnamed(struct named *np, env_t *envp)
+{
+        struct nlist *bind;
+        exp_t *args, *op;
+        env_t *ep;
+        int i;
+
+        for (args = null, i = 0; i < np->argc; i++)
+                push(single(evproc(np->rands[i], envp)), args);
+        ep = extsize(1, envp);
+        bind = install(np->name, undefined, ep);
+        op = evproc(np->op, ep);
+        label(op) = np->name;
+        bind->defn = op;
+        return apply(op, nreverse(args));
+}
+
+/* Value returned by evjump to restart the innermost loop. */
+static exp_t jump = { ATOM, { "*jump*" } };
+
+/* Return a number of type t whose value is x. */
+static inline exp_t *
+nnum(int t, double x)
+{
+        return t == TFXN ? nfixnum((int)x) : nfloat(x);
+}
+
+/*
+ * Evaluate a loop.  The loop owns the numbers bound to its owned
+ * variables as long as their type is the inferred one: they're new
+ * objects that can't be reached from elsewhere, and they're updated
+ * in place.  Once an intrinsic relied upon is bound again, the body
+ * may capture the frame and a new one is created at each iteration.
+ */
+static exp_t *
+evloop(struct loop *lp, env_t *envp)
+{
+        struct nlist *binds[lp->nvars+1];
+        int own[lp->nvars+1];
+        env_t *ep;
+        exp_t *res, *val;
+        int i, ok;
+
+        ep = extsize(lp->nvars, envp);
+        ok = opsok(lp);
+        for (i = 0; i < lp->nvars; i++) {
+                val = single(evproc(lp->inits[i], envp));
+                if ((own[i] = ok && lp->owned[i] && tbit(val) == lp->types[i]))
+                        val = nnum(lp->types[i], isfxn(val) ? fixnum(val) :
+                                   flt(val));
+                binds[i] = install(lp->vars[i], val, ep);
+        }
+        while ((res = evproc(lp->body, ep)) == &jump)
+                if (lp->fresh || !(ok = opsok(lp))) {
+                        ep = extsize(lp->nvars, envp);
+                        for (i = 0; i < lp->nvars; i++) {
+                                own[i] = 0;
+                                binds[i] = install(lp->vars[i], jmpargs[i] ?
+                                                   jmpargs[i] :
+                                                   nnum(lp->types[i],
+                                                        jmpnums[i]), ep);
+                        }
+                } else {
+                        for (i = 0; i < lp->nvars; i++)
+                                if (jmpargs[i] != NULL)
+                                        own[i] = 0, binds[i]->defn = jmpargs[i];
+                                else if (own[i] && ok) {
+                                        if (lp->types[i] == TFXN)
+                                                fixnum(binds[i]->defn) =
+                                                        (int)jmpnums[i];
+                                        else
+                                                flt(binds[i]->defn) =
+                                                        jmpnums[i];
+                                } else {
+                                        own[i] = ok && lp->owned[i];
+                                        binds[i]->defn = nnum(lp->types[i],
+                                                              jmpnums[i]);
+                                }
+                }
+        for (i = 0; i < lp->nvars; i++)
+                if (own[i] && res == binds[i]->defn) /* it's no longer owned */
+                        return nnum(lp->types[i], isfxn(res) ? fixnum(res) :
+                                    flt(res));
+        return res;
+}
+
+/*
+ * Compute a numeric expression of type t into *xp.  Return zero if a
+ * leaf isn't of this type.  The fixnums are truncated after each
+ * operation like the ones allocated by the primitives.
+ */
+static int
+evtnum(struct tnum *tp, int t, double *xp, env_t *envp)
+{
+        exp_t *ep;
+        double a, b;
+
+        if (tp->op < 0) {
+                if (tbit(ep = evproc(tp->leaf, envp)) != t)
+                        return 0;
+                *xp = t == TFXN ? fixnum(ep) : flt(ep);
+                return 1;
+        }
+        if (!evtnum(tp->rand[0], t, &a, envp) ||
+            !evtnum(tp->rand[1], t, &b, envp))
+                return 0;
+        switch (tp->op) {
+        case PADD:
+                *xp = t == TFXN ? (int)((long)a + (long)b) : a + b;
+                break;
+        case PSUB:
+                *xp = t == TFXN ? (int)((long)a - (long)b) : a - b;
+                break;
+        default:
+                *xp = t == TFXN ? (int)((long)a * (long)b) : a * b;
+                break;
+        }
+        return 1;
+}
+
+/*
+ * Evaluate the new values of the variables of the innermost loop and
+ * jump back to it.  The value of a variable whose computation is
+ * numeric is stored in jmpnums, with a null pointer in jmpargs.
+ */
+static exp_t *
+evjump(struct jump *jp, env_t *envp)
 {
-        struct nlist *np;
+        struct loop *lp = jp->loop;
+        exp_t *vals[lp->nvars+1];
+        double nums[lp->nvars+1];
+        int i, ok;
+
+        ok = opsok(lp);
+        for (i = 0; i < lp->nvars; i++)
+                if (jp->steps[i] && ok &&
+                    evtnum(jp->steps[i], lp->types[i], nums+i, envp))
+                        vals[i] = NULL;
+                else
+                        vals[i] = single(evproc(jp->args[i], envp));
+        memcpy(jmpargs, vals, lp->nvars*sizeof(*vals));
+        memcpy(jmpnums, nums, lp->nvars*sizeof(*nums));
+        return &jump;
+}
 
-        if (!(np = lookup(symp(var), envp)) || np->defn == undefined)
-                everr("unbound variable", var);
-        return np->defn;
+/* Evaluate an application expression. */
+static exp_t *
+evapp(evproc_t **argv, env_t *envp)
+{
+        evproc_t *op;
+        exp_t *args;
+
+        op = *argv++;
+        for (args = null; *argv; argv++)
+                push(single(evproc(*argv, envp)), args);
+        return apply(evproc(op, envp), nreverse(args));
 }
 
-#define valerr(var) RAISE1(eval_error,                                       \
-                           "the expression assigned to %s returns no value", \
-                           var)
+#define NPROFILE        8       /* evaluations before specializing */
 
-/* Evaluate a define expression */
+/* Return the index of an arithmetic primitive in intrinsic or -1. */
+static int
+arith(exp_t *op)
+{
+        int i;
+
+        for (i = PADD; i <= PGT; i++)
+                if (op == intrinsic[i])
+                        return i;
+        return -1;
+}
+
+/* Evaluate an application to two operands and profile it. */
 static exp_t *
-evdef(void **argv, env_t *envp)
+evbinapp(struct binapp *bp, env_t *envp)
 {
-        symb_t *var;
-        evproc_t *vproc;
-        exp_t *val;
+        exp_t *a, *b, *op;
+
+        a = single(evproc(bp->rand[0], envp));
+        b = single(evproc(bp->rand[1], envp));
+        op = evproc(bp->op, envp);
+        if (bp->seen != TANY) {
+                if (bp->prim != op && (bp->prim || arith(op) < 0))
+                        bp->seen = TANY;
+                else {
+                        bp->prim = op;
+                        bp->seen |= tbit(a) | tbit(b);
+                }
+                if (++bp->count == NPROFILE && bp->seen == TFXN)
+                        bp->self->eval = evbinfxn;
+                else if (bp->count == NPROFILE && bp->seen == TFLT)
+                        bp->self->eval = evbinflt;
+        }
+        return apply(op, cons(a, cons(b, null)));
+}
 
-        var = (symb_t *)argv[0];
-        vproc = (evproc_t *)argv[1];
-	if (!(val = evproc(vproc, envp)))
-                valerr(var);
-        if (type(val) == PROC && label(val) == NULL)
-                label(val) = strtoatm(var); /* label anonymous procedure */
-        install(var, val, envp);
+/* The guard of a specialized binapp failed: fall back to evbinapp. */
+static exp_t *
+despecialize(struct binapp *bp, exp_t *op, exp_t *a, exp_t *b)
+{
+        bp->self->eval = evbinapp;
+        bp->seen = TANY;
+        return apply(op, cons(single(a), cons(single(b), null)));
+}
 
-        return NULL;
+/*
+ * Evaluate an application of an arithmetic primitive to two fixnums.
+ * The result is computed as a long and converted back to a fixnum
+ * like in the generic primitives.
+ */
+static exp_t *
+evbinfxn(struct binapp *bp, env_t *envp)
+{
+        exp_t *a, *b, *op;
+        long x, y;
+
+        a = evproc(bp->rand[0], envp);
+        b = evproc(bp->rand[1], envp);
+        op = evproc(bp->op, envp);
+        if (op != bp->prim || !isfxn(a) || !isfxn(b))
+                return despecialize(bp, op, a, b);
+        x = fixnum(a), y = fixnum(b);
+        switch (arith(op)) {
+        case PADD:
+                return nfixnum(x + y);
+        case PSUB:
+                return nfixnum(x - y);
+        case PPROD:
+                return nfixnum(x * y);
+        case PNUMEQ:
+                return x == y ? true : false;
+        case PLT:
+                return x < y ? true : false;
+        case PGT:
+                return x > y ? true : false;
+        }
+        return despecialize(bp, op, a, b);
 }
 
-/* Evaluate a set! expression. */
+/* Evaluate an application of an arithmetic primitive to two floats. */
 static exp_t *
-evset(void **argv, env_t *envp)
+evbinflt(struct binapp *bp, env_t *envp)
 {
-        exp_t *var, *val;
-        struct nlist *np;
+        exp_t *a, *b, *op;
+        double x, y;
+
+        a = evproc(bp->rand[0], envp);
+        b = evproc(bp->rand[1], envp);
+        op = evproc(bp->op, envp);
+        if (op != bp->prim || !isfloat(a) || !isfloat(b))
+                return despecialize(bp, op, a, b);
+        x = flt(a), y = flt(b);
+        switch (arith(op)) {
+        case PADD:
+                return nfloat(x + y);
+        case PSUB:
+                return nfloat(x - y);
+        case PPROD:
+                return nfloat(x * y);
+        case PNUMEQ:
+                return x == y ? true : false;
+        case PLT:
+                return x < y ? true : false;
+        case PGT:
+                return x > y ? true : false;
+        }
+        return despecialize(bp, op, a, b);
+}
 
-        var = argv[0];
-        if (!(val = evproc((evproc_t *)argv[1], envp)))
-                valerr(symp(var));
-        if (!(np = lookup(symp(var), envp)))
-                everr("unbound variable", var);
-        np->defn = val;
-        return NULL;
+/*
+ * Evaluate an inlined intrinsic, or the application if the name of
+ * the intrinsic has been defined or assigned since the analysis.
+ */
+#define GUARD(pp)       do {                                    \
+                if (atmver((pp)->name) != (pp)->ver)            \
+                        return evproc((pp)->app, envp);         \
+        } while (0)
+
+/* Evaluate an inlined car. */
+static exp_t *
+evcar(struct prim *pp, env_t *envp)
+{
+        exp_t *a;
+
+        GUARD(pp);
+        if (!ispair(a = single(evproc(pp->rand[0], envp))))
+                everr("car: the argument isn't a pair", a);
+        return car(a);
 }
 
-/* Set the car or the cdr of an expression to a new value. */
+/* Evaluate an inlined cdr. */
 static exp_t *
-evsetpair(evproc_t **argv, env_t *envp)
+evcdr(struct prim *pp, env_t *envp)
 {
-        exp_t *var, *val;
+        exp_t *a;
 
-        if (!ispair(var = evproc(argv[1], envp)))
-                everr("should be a pair", var);
-        if (!(val = evproc(argv[2], envp)))
-                valerr(symp(var));
-        if ((place_t)argv[0] == CAR)
-                car(var) = val;
-        else
-                cdr(var) = val;
-        return NULL;
+        GUARD(pp);
+        if (!ispair(a = single(evproc(pp->rand[0], envp))))
+                everr("cdr: the argument isn't a pair", a);
+        return cdr(a);
 }
 
-/* Evaluate an if expression */
+/* Evaluate an inlined cons. */
 static exp_t *
-evif(evproc_t **argv, env_t *envp)
+evcons(struct prim *pp, env_t *envp)
 {
-        evproc_t *pred, *res;
+        exp_t *a;
 
-        pred = argv[0];
-        res = (!iseq(false, evproc(pred, envp)) ? argv[1] : argv[2]);
-        return evproc(res, envp);
+        GUARD(pp);
+        a = single(evproc(pp->rand[0], envp));
+        return cons(a, single(evproc(pp->rand[1], envp)));
 }
 
-/* Evaluate a begin expression */
+/* Evaluate an inlined eq?. */
 static exp_t *
-evbegin(evproc_t **argv, env_t *envp)
+eveq(struct prim *pp, env_t *envp)
 {
-        for (; *(argv+1); argv++)
-                evproc(argv[0], envp);
-        return evproc(argv[0], envp);
+        exp_t *a;
+
+        GUARD(pp);
+        a = single(evproc(pp->rand[0], envp));
+        return iseq(a, single(evproc(pp->rand[1], envp))) ? true : false;
 }
 
-/* Evaluate a cond expression */
+/* Evaluate an inlined addition of two operands. */
 static exp_t *
-evcond(evproc_t **argv, env_t *envp)
+evadd(struct prim *pp, env_t *envp)
 {
-        exp_t *b;
+        exp_t *a, *b;
+
+        GUARD(pp);
+        a = single(evproc(pp->rand[0], envp));
+        b = single(evproc(pp->rand[1], envp));
+        if (isfxn(a) && isfxn(b))
+                return nfixnum((long)fixnum(a) + fixnum(b));
+        if (isfloat(a) && isfloat(b))
+                return nfloat(flt(a) + flt(b));
+        return apply(intrinsic[PADD], cons(a, cons(b, null)));
+}
 
-        for (; *argv; argv += 2)
-                if (iselse(*argv) || !iseq(false, b = evproc(*argv, envp)))
-                        return isarrow(*(argv+1)) ?
-                                apply(evproc(*(argv+2), envp), cons(b, null)) :
-                                evproc(*(argv+1), envp);
-                else if (isarrow(*(argv+1)))
-                        ++argv;
+/* Evaluate an inlined comparison of two operands. */
+static exp_t *
+evlt(struct prim *pp, env_t *envp)
+{
+        exp_t *a, *b;
+
+        GUARD(pp);
+        a = single(evproc(pp->rand[0], envp));
+        b = single(evproc(pp->rand[1], envp));
+        if (isfxn(a) && isfxn(b))
+                return fixnum(a) < fixnum(b) ? true : false;
+        if (isfloat(a) && isfloat(b))
+                return flt(a) < flt(b) ? true : false;
+        return apply(intrinsic[PLT], cons(a, cons(b, null)));
+}
+
+/*
+ * Evaluate an inlined call.  If the variable changed since the call
+ * was linked, it is linked again to the new procedure if it can be
+ * inlined, and otherwise the procedure is applied as usual.
+ */
+static exp_t *
+evinline(struct inl *ip, env_t *envp)
+{
+        struct nlist *np;
+        exp_t *vals[ip->argc+1], *args, *p;
+        env_t *ep;
+        int i;
+
+        for (i = 0; i < ip->argc; i++)
+                vals[i] = single(evproc(ip->rands[i], envp));
+        if (atmver(ip->name) != ip->ver) {
+                ip->ver = atmver(ip->name);
+                ip->lamp = (np = lookup(ip->name, globenv)) ?
+                        inlinable(np->defn, ip->name, ip->argc) : NULL;
+        }
+        if (ip->lamp == NULL) {
+                for (args = null; i > 0; i--)
+                        args = cons(vals[i-1], args);
+                return apply(evproc(ip->op, envp), args);
+        }
+        if (ip->lamp->bodyp == NULL)
+                anbody(ip->lamp, NULL);
+        ep = extsize(ip->lamp->nlocals, globenv);
+        for (i = 0, p = ip->lamp->parp; i < ip->argc; i++, p = cdr(p))
+                install(symp(car(p)), vals[i], ep);
+        return evproc(ip->lamp->bodyp, ep);
+}
+
+/* Evaluate a call to values into the registers. */
+static exp_t *
+evvalues(struct vals *vp, env_t *envp)
+{
+        exp_t *vals[vp->argc+1];
+        int i;
+
+        GUARD(vp);
+        if (vp->argc == 1)
+                return evproc(vp->rands[0], envp);
+        for (i = 0; i < vp->argc; i++)
+                vals[i] = single(evproc(vp->rands[i], envp));
+        growvals(vp->argc);
+        memcpy(valreg, vals, vp->argc*sizeof(*vals));
+        nvals = vp->argc;
+        return &multiple;
+}
+
+/* Evaluate a receive expression or a call to call-with-values. */
+static exp_t *
+evrecv(struct recv *rp, env_t *envp)
+{
+        exp_t *op, *res;
+
+        if (rp->name)
+                GUARD(rp);
+        op = rp->cons ? evproc(rp->cons, envp) : NULL;
+        res = evproc(rp->prod, envp);
+        if (rp->thunk)
+                res = apply(res, null);
+        if (rp->lamp)
+                return deliver(rp->lamp, envp, res, rp->lamp->parp);
+        return consume(op, res);
+}
+
+static struct module *modules;  /* modules defined in the process */
+static exp_t *loading;          /* names of the modules being loaded */
+
+/* Return the module whose name is s or NULL. */
+static struct module *
+findmod(symb_t *s)
+{
+        struct module *mp;
 
+        for (mp = modules; mp; mp = mp->next)
+                if (mp->name == s)
+                        return mp;
         return NULL;
 }
 
-/* Evaluate an `and' expression */
+/*
+ * Evaluate a module definition.  A module is only evaluated once by
+ * process: it's ignored if a module of the same name is defined.
+ */
 static exp_t *
-evand(evproc_t **argv, env_t *envp)
+evmodule(struct module *mp, env_t *envp)
 {
-        exp_t *pred;
+        if (findmod(mp->name))
+                return NULL;
+        evimport(mp->imports, envp);
+        mp->vals = apply(nproc(nfunc(mp->lamp, envp)), null);
+        mp->next = modules;
+        modules = mp;
+        return NULL;
+}
 
-        for (pred = true; *argv && !iseq(false, pred); argv++)
-                pred = evproc(*argv, envp);
-        return pred;
+/*
+ * Check that the global variable s can be bound to the value imported
+ * from a module: it mustn't be bound to another value, by an import
+ * or not.
+ */
+static void
+chkimp(symb_t *s, exp_t *val)
+{
+        struct nlist *np;
+
+        if (!(np = lookup(s, globenv)) || np->defn == val)
+                return;
+        if (atmimp(s))
+                everr("already imported from another module", atom(s));
+        if (np->defn != undefined)
+                everr("already defined in the global environment", atom(s));
 }
 
-/* Evaluate an `or' expression */
+/* Bind the global variable s to the value imported from a module. */
+static void
+bindimp(symb_t *s, exp_t *val)
+{
+        if (atmimp(s))
+                return;
+        install(s, val, globenv);
+        atmver(s)++;
+        atmimp(s) = 1;
+}
+
+/*
+ * Evaluate an import expression.  The exported variables of each
+ * module are bound in the global environment.  A module not yet
+ * defined is loaded from the file <name>.scm in the current directory.
+ */
 static exp_t *
-evor(evproc_t **argv, env_t *envp)
+evimport(exp_t *names, env_t *envp)
 {
-        exp_t *pred;
+        struct module *mp;
+        exp_t *p, *vars, *vals;
+        char path[BUFSIZ];
+        int rc;
+
+        for (; ispair(names); names = cdr(names)) {
+                if (!(mp = findmod(symp(car(names))))) {
+                        for (p = loading; ispair(p); p = cdr(p))
+                                if (iseq(car(p), car(names)))
+                                        everr("circular import of the module",
+                                              car(names));
+                        snprintf(path, BUFSIZ, "%s.scm", symp(car(names)));
+                        loading = cons(car(names), loading);
+                        rc = load(path, NINTER);
+                        loading = cdr(loading);
+                        if (rc || !(mp = findmod(symp(car(names)))))
+                                everr("can't find the module", car(names));
+                }
+                for (vars = mp->exports, vals = mp->vals; ispair(vars);
+                     vars = cdr(vars), vals = cdr(vals))
+                        chkimp(symp(car(vars)), car(vals));
+                for (vars = mp->exports, vals = mp->vals; ispair(vars);
+                     vars = cdr(vars), vals = cdr(vals))
+                        bindimp(symp(car(vars)), car(vals));
+        }
+        return NULL;
+}
 
-        for (pred = false; *argv && iseq(false, pred); argv++)
-                pred = evproc(*argv, envp);
-        return pred;
+/* Elements of the lists traversed by a fused chain (see evfuse). */
+struct cursor {
+        exp_t  **lists;         /* lists traversed in sequence */
+        int      nlist;         /* number of lists */
+        exp_t   *p;             /* rest of the current list */
+        exp_t  **buf;           /* or elements of the previous stage */
+        long     len;           /* number of elements in buf */
+        long     pos;           /* index of the next one */
+        int      back;          /* are they read backward? */
+};
+
+/* Store the next element of the cursor in *xp and return zero at the end. */
+static int
+next(struct cursor *cp, exp_t **xp)
+{
+        if (cp->buf) {
+                if (cp->pos == cp->len)
+                        return 0;
+                *xp = cp->buf[cp->back ? cp->len-1-cp->pos++ : cp->pos++];
+                return 1;
+        }
+        while (!ispair(cp->p)) {
+                if (!isnull(cp->p))
+                        everr("should be a list", cp->p);
+                if (cp->nlist == 0)
+                        return 0;
+                cp->nlist--;
+                cp->p = *cp->lists++;
+        }
+        *xp = car(cp->p);
+        cp->p = cdr(cp->p);
+        return 1;
 }
 
-/* Evaluate a lambda expression */
+/* Store the remaining elements of the cursor in a new buffer and read it. */
+static void
+drain(struct cursor *cp, exp_t *proc)
+{
+        exp_t **buf, *x;
+        long len, size;
+
+        buf = NULL;
+        len = size = 0;
+        while (next(cp, &x)) {
+                if (len == size)
+                        buf = srealloc(buf, (size = size ? 2*size : 8)*
+                                       sizeof(*buf));
+                buf[len++] = proc ? apply(proc, cons(x, null)) : x;
+        }
+        cp->buf = buf;
+        cp->len = len;
+        cp->pos = 0;
+        cp->back = 0;
+}
+
+/*
+ * Evaluate a fused chain of list procedures.  The operands are
+ * evaluated in the same order as the applications would, from the
+ * outermost to the source.  Each stage then sees all the elements
+ * before the next one, so that the procedures are applied in the same
+ * order too.  The elements between the stages are stored in a buffer
+ * instead of a list: a map fills a new one and a reverse reads the
+ * previous one backward.  Like the pairs it replaces, a buffer isn't
+ * freed so that continuations may reenter the traversal.
+ */
 static exp_t *
-evlambda(void **argv, env_t *envp)
+evfuse(struct fuse *fp, env_t *envp)
 {
-        return nproc(nfunc((exp_t *)argv[0], (evproc_t *)argv[1], envp));
+        struct stage *sp = fp->stages;
+        struct cursor c;
+        exp_t *procs[fp->nstage], *lists[fp->nsrc], *res, *tail, *x;
+        int i;
+
+        if (fp->name && atmver(fp->name) != fp->ver)
+                return evproc(fp->app, envp);
+        for (i = 0; i < fp->nstage; i++)
+                if (atmver(sp[i].name) != sp[i].ver)
+                        return evproc(fp->app, envp);
+
+        res = NULL;
+        for (i = 0; i < fp->nstage; i++) {
+                procs[i] = sp[i].proc ? evproc(sp[i].proc, envp) : NULL;
+                if (sp[i].init)
+                        res = single(evproc(sp[i].init, envp));
+        }
+        for (i = 0; i < fp->nsrc; i++)
+                lists[i] = evproc(fp->srcs[i], envp);
+        c.lists = lists;
+        c.nlist = fp->nsrc;
+        c.p = null;
+        c.buf = NULL;
+
+        for (i = fp->nstage-1; i > 0; i--)
+                if (sp[i].op == LMAP)
+                        drain(&c, procs[i]);
+                else {                  /* reverse */
+                        if (!c.buf)
+                                drain(&c, NULL);
+                        c.back = !c.back;
+                }
+
+        switch (sp[0].op) {
+        case LMAP:
+                res = tail = null;
+                while (next(&c, &x)) {
+                        x = cons(apply(procs[0], cons(x, null)), null);
+                        if (isnull(res))
+                                res = tail = x;
+                        else
+                                tail = cdr(tail) = x;
+                }
+                break;
+        case LREVERSE:
+                res = null;
+                while (next(&c, &x))
+                        res = cons(x, res);
+                break;
+        case LFOLDL:
+                while (next(&c, &x))
+                        res = apply(procs[0], cons(x, cons(res, null)));
+                break;
+        default:                /* foldr */
+                if (!c.buf)
+                        drain(&c, NULL);
+                c.back = !c.back;
+                while (next(&c, &x))
+                        res = apply(procs[0], cons(x, cons(res, null)));
+                break;
+        }
+        return res;
 }
 
-/* Eval a let expression */
+/* Build a pair of a quasi-quote template. */
 static exp_t *
-evlet(evproc_t **argv, env_t *envp)
+evqcons(evproc_t **argv, env_t *envp)
 {
-        if (argv[0])           /* named let */
-                evproc(argv[0], envp);
-        return evproc(argv[1], envp);
+        exp_t *car;
+
+        car = single(evproc(argv[0], envp));
+        return cons(car, single(evproc(argv[1], envp)));
 }
 
-/* Evaluate an application expression. */
+/*
+ * Splice a list into a quasi-quote template.  The list is copied in
+ * one pass, except at the end of the template where it's shared.
+ */
 static exp_t *
-evapp(evproc_t **argv, env_t *envp)
+evsplice(evproc_t **argv, env_t *envp)
 {
-        evproc_t *op;
-        exp_t *args;
+        exp_t *lst, *rest, *head, *tail, *p;
+
+        lst = evproc(argv[0], envp);
+        rest = single(evproc(argv[1], envp));
+        if (isnull(rest)) {
+                if (!islist(lst))
+                        everr("should be a list", lst);
+                return lst;
+        }
+        head = tail = NULL;
+        for (p = lst; ispair(p); p = cdr(p))
+                if (head == NULL)
+                        head = tail = cons(car(p), null);
+                else
+                        tail = cdr(tail) = cons(car(p), null);
+        if (!isnull(p))
+                everr("should be a list", lst);
+        if (head == NULL)
+                return rest;
+        cdr(tail) = rest;
+        return head;
+}
 
-        op = *argv++;
-        for (args = null; *argv; argv++)
-                push(evproc(*argv, envp), args);
-        return apply(evproc(op, envp), nreverse(args));
+/*
+ * Compiled evaluation procedures.
+ *
+ * The evaluation procedures of the top-level forms are saved in the
+ * compiled files (see fasl.c).  A node is written as the index of its
+ * evaluation function in nodes, which doesn't depend on the process,
+ * followed by its operands.  The forms with other nodes, like loops
+ * or fused chains, are saved as expressions and analyzed on each load.
+ * FASLVER must be incremented whenever one of these nodes changes.
+ *
+ * The versions of the names relied upon by the inlined nodes are only
+ * meaningful in the process that analyzed them.  They're set again
+ * when the form is evaluated, as its analysis would have done (see
+ * evlinked).
+ */
+
+enum nkind { NSELF, NVAR, NDEF, NSET, NSETPAIR, NIF, NBEGIN, NCOND, NAND,
+             NOR, NLAMBDA, NAPP, NBINAPP, NCAR, NCDR, NCONS, NEQ, NADD, NLT,
+             NINLINE, NVALUES, NMODULE, NIMPORT, NKINDS };
+
+/* Evaluation functions of the kinds of nodes that can be saved. */
+static exp_t *(*const nodes[NKINDS])() = {
+        [NSELF] = evself, [NVAR] = evvar, [NDEF] = evdef, [NSET] = evset,
+        [NSETPAIR] = evsetpair, [NIF] = evif, [NBEGIN] = evbegin,
+        [NCOND] = evcond, [NAND] = evand, [NOR] = evor,
+        [NLAMBDA] = evlambda, [NAPP] = evapp, [NBINAPP] = evbinapp,
+        [NCAR] = evcar, [NCDR] = evcdr, [NCONS] = evcons, [NEQ] = eveq,
+        [NADD] = evadd, [NLT] = evlt, [NINLINE] = evinline,
+        [NVALUES] = evvalues, [NMODULE] = evmodule, [NIMPORT] = evimport
+};
+
+/* Intrinsics of the nodes inlining one. */
+static const int nodeprim[NKINDS] = {
+        [NCAR] = PCAR, [NCDR] = PCDR, [NCONS] = PCONS, [NEQ] = PEQ,
+        [NADD] = PADD, [NLT] = PLT, [NVALUES] = PVALUES
+};
+
+/* Represents a top-level node loaded from a compiled file. */
+struct linked {
+        evproc_t   *body;       /* the node */
+        int         nlinks;     /* number of nodes to link */
+        evproc_t  **links;      /* nodes relying on global names */
+        int         size;       /* size of links */
+};
+
+/* Return the kind of the node or -1 if it can't be saved. */
+static int
+nkind(evproc_t *epp)
+{
+        int k;
+
+        if (epp->eval == evbinfxn || epp->eval == evbinflt)
+                return NBINAPP; /* specialized since its analysis */
+        if (epp->eval == evimpvar)
+                return NVAR;    /* the module may have changed */
+        for (k = 0; k < NKINDS && epp->eval != nodes[k]; k++)
+                ;
+        return k < NKINDS ? k : -1;
+}
+
+/*
+ * Test if the expression is made of objects returned by the reader.
+ * The rests of the lists are kept on a stack, like in the printer.
+ */
+static int
+isreadable(exp_t *ep)
+{
+        exp_t **stack = NULL;
+        size_t n = 0, size = 0;
+        int ok;
+
+        for (;;) {
+                for (; ispair(ep); ep = car(ep)) {
+                        if (n == size) {
+                                size = size ? 2*size : 32;
+                                stack = srealloc(stack, size*sizeof(*stack));
+                        }
+                        stack[n++] = cdr(ep);
+                }
+                ok = ep != NULL && !isproc(ep) &&
+                        (!isbool(ep) || ep == true || ep == false);
+                if (!ok || n == 0)
+                        break;
+                ep = stack[--n];
+        }
+        free(stack);
+        return ok;
 }
 
-static exp_t *evqquote1(exp_t *, evproc_t **, int *, env_t *);
+/* Test if the lambda expression can be saved. */
+static int
+isportlam(struct lambda *lp)
+{
+        return isreadable(lp->parp) && lp->body && isreadable(lp->body) &&
+                (lp->scope == NULL || isreadable(lp->scope));
+}
 
-/* Evaluate a quasi-quote expression. */
-static exp_t *
-evqquote(evproc_t **argv, env_t *envp)
+/* Test if the nodes of the NULL-terminated array can be saved. */
+static int
+isportvec(evproc_t **v)
 {
-        int argc;
+        for (; *v; v++)
+                if (*v != keywords[ELSE] && *v != keywords[ARROW] &&
+                    !isportable(*v))
+                        return 0;
+        return 1;
+}
 
-        argc = 1;
-        return evqquote1((exp_t *)argv[0], argv, &argc, envp);
+/* Test if the evaluation procedure can be saved by putproc. */
+int
+isportable(evproc_t *epp)
+{
+        evproc_t **v = epp->argv;
+        struct binapp *bp;
+        struct prim *pp;
+        struct inl *ip;
+        struct vals *vp;
+        struct module *mp;
+        int i;
+
+        switch (nkind(epp)) {
+        case NSELF:
+                return epp->argv == NULL || isreadable(epp->argv);
+        case NVAR:
+                return epp->eval == evimpvar || isreadable(epp->argv);
+        case NIMPORT:
+                return isreadable(epp->argv);
+        case NDEF:
+        case NSET:
+                return isportable(v[1]);
+        case NSETPAIR:
+                return isportable(v[1]) && isportable(v[2]);
+        case NIF:
+                return isportable(v[0]) && isportable(v[1]) &&
+                        isportable(v[2]);
+        case NBEGIN:
+        case NCOND:
+        case NAND:
+        case NOR:
+        case NAPP:
+                return isportvec(v);
+        case NLAMBDA:
+                return isportlam(epp->argv);
+        case NBINAPP:
+                bp = epp->argv;
+                return isportable(bp->op) && isportable(bp->rand[0]) &&
+                        isportable(bp->rand[1]);
+        case NINLINE:
+                ip = epp->argv;
+                for (i = 0; i < ip->argc; i++)
+                        if (!isportable(ip->rands[i]))
+                                return 0;
+                return isportable(ip->op);
+        case NVALUES:
+                vp = epp->argv;
+                for (i = 0; i < vp->argc; i++)
+                        if (!isportable(vp->rands[i]))
+                                return 0;
+                return isportable(vp->app);
+        case NMODULE:
+                mp = epp->argv;
+                return isreadable(mp->exports) && isreadable(mp->imports) &&
+                        isportlam(mp->lamp);
+        case -1:
+                return 0;
+        default:        /* inlined intrinsic */
+                pp = epp->argv;
+                return isportable(pp->rand[0]) &&
+                        (pp->rand[1] == NULL || isportable(pp->rand[1]));
+        }
+}
+
+/* Encode a lambda expression. */
+static void
+putlam(fasl_t *fp, struct lambda *lp)
+{
+        faslputexp(fp, lp->parp);
+        faslputexp(fp, lp->body);
+        faslputint(fp, lp->scope != NULL);
+        if (lp->scope)
+                faslputexp(fp, lp->scope);
+}
+
+/* Encode the n evaluation procedures of v. */
+static void
+putvec(fasl_t *fp, evproc_t **v, int n)
+{
+        int i;
+
+        faslputint(fp, n);
+        for (i = 0; i < n; i++)
+                putproc(fp, v[i]);
+}
+
+/*
+ * Encode an evaluation procedure for which isportable is true.  The
+ * application of an inlined intrinsic isn't saved: it's built again
+ * from the name of the intrinsic, and an imported variable is saved
+ * as a reference to its name.  The bodies of the lambdas are
+ * analyzed again on their first call.
+ */
+void
+putproc(fasl_t *fp, evproc_t *epp)
+{
+        evproc_t **v = epp->argv;
+        struct binapp *bp;
+        struct prim *pp;
+        struct inl *ip;
+        struct vals *vp;
+        struct module *mp;
+        int k, n;
+
+        faslputint(fp, k = nkind(epp));
+        switch (k) {
+        case NSELF:
+                faslputint(fp, epp->argv != NULL);
+                if (epp->argv)
+                        faslputexp(fp, epp->argv);
+                break;
+        case NVAR:
+                faslputexp(fp, epp->eval == evimpvar ? v[1] : epp->argv);
+                break;
+        case NIMPORT:
+                faslputexp(fp, epp->argv);
+                break;
+        case NDEF:
+                faslputsym(fp, (symb_t *)v[0]);
+                putproc(fp, v[1]);
+                break;
+        case NSET:
+                faslputsym(fp, symp((exp_t *)v[0]));
+                putproc(fp, v[1]);
+                break;
+        case NSETPAIR:
+                faslputint(fp, (place_t)v[0] == CAR);
+                putproc(fp, v[1]);
+                putproc(fp, v[2]);
+                break;
+        case NIF:
+                putproc(fp, v[0]);
+                putproc(fp, v[1]);
+                putproc(fp, v[2]);
+                break;
+        case NCOND:
+                for (n = 0; v[n]; n++)
+                        ;
+                faslputint(fp, n);
+                for (n = 0; v[n]; n++)
+                        if (v[n] == keywords[ELSE])
+                                faslputint(fp, 1);
+                        else if (v[n] == keywords[ARROW])
+                                faslputint(fp, 2);
+                        else {
+                                faslputint(fp, 0);
+                                putproc(fp, v[n]);
+                        }
+                break;
+        case NBEGIN:
+        case NAND:
+        case NOR:
+        case NAPP:
+                for (n = 0; v[n]; n++)
+                        ;
+                putvec(fp, v, n);
+                break;
+        case NLAMBDA:
+                putlam(fp, epp->argv);
+                break;
+        case NBINAPP:
+                bp = epp->argv;
+                putproc(fp, bp->op);
+                putproc(fp, bp->rand[0]);
+                putproc(fp, bp->rand[1]);
+                break;
+        case NINLINE:
+                ip = epp->argv;
+                faslputsym(fp, ip->name);
+                putvec(fp, ip->rands, ip->argc);
+                putproc(fp, ip->op);
+                break;
+        case NVALUES:
+                vp = epp->argv;
+                faslputsym(fp, vp->name);
+                putvec(fp, vp->rands, vp->argc);
+                putproc(fp, vp->app);
+                break;
+        case NMODULE:
+                mp = epp->argv;
+                faslputsym(fp, mp->name);
+                faslputexp(fp, mp->exports);
+                faslputexp(fp, mp->imports);
+                putlam(fp, mp->lamp);
+                break;
+        default:        /* inlined intrinsic */
+                pp = epp->argv;
+                faslputsym(fp, pp->name);
+                putvec(fp, pp->rand, pp->rand[1] ? 2 : 1);
+                break;
+        }
+}
+
+/* Return the version of the name s if it's bound to intrinsic i. */
+static unsigned
+guard(symb_t *s, int i)
+{
+        struct nlist *np;
+
+        if ((np = lookup(s, globenv)) && np->defn == intrinsic[i])
+                return atmver(s);
+        return atmver(s) - 1;   /* never inlined */
+}
+
+/* Link a node of a compiled file to the current global environment. */
+static void
+relink(evproc_t *epp)
+{
+        struct lambda *lp;
+        struct prim *pp;
+        struct inl *ip;
+        struct vals *vp;
+        int k;
+
+        switch (k = nkind(epp)) {
+        case NLAMBDA:
+                lp = epp->argv;
+                if (eager && lp->bodyp == NULL)
+                        anbody(lp, NULL);
+                break;
+        case NINLINE:
+                ip = epp->argv;
+                ip->ver = atmver(ip->name) - 1; /* linked on the first call */
+                break;
+        case NVALUES:
+                vp = epp->argv;
+                vp->ver = guard(vp->name, PVALUES);
+                break;
+        default:        /* inlined intrinsic */
+                pp = epp->argv;
+                pp->ver = guard(pp->name, nodeprim[k]);
+                break;
+        }
 }
 
 /*
- * Traverse the template expression in deep-first order.  Each time we
- * encounter the expression `unquote` or `splice', we replace them by
- * the value returned by the evaluation procedure stored in `argv' at
- * the index `*argcp'.
+ * Evaluate a top-level node of a compiled file.  Its nodes relying on
+ * global names are linked first.
  */
 static exp_t *
-evqquote1(exp_t *template, evproc_t **argv, int *argcp, env_t *envp)
+evlinked(struct linked *lp, env_t *envp)
 {
-        exp_t *res, *car, *cdr;
+        int i;
 
-        if (ispair(template)) {
-                car = evqquote1(car(template), argv, argcp, envp);
-                cdr = evqquote1(cdr(template), argv, argcp, envp);
-                if (car(template) == splice) {
-                        if (!islist(car))
-                                everr("should be a list", car);
-                        res = nconc(car, cdr);
-                } else
-                        res = cons(car,  cdr);
-        } else if (template == unquote || template == splice)
-                res = evproc(argv[(*argcp)++], envp);
-        else
-                res = template;
-        return res;
+        for (i = 0; i < lp->nlinks; i++)
+                relink(lp->links[i]);
+        return evproc(lp->body, envp);
+}
+
+/* Return the node after adding it to the nodes to link. */
+static evproc_t *
+addlink(struct linked *lp, evproc_t *epp)
+{
+        if (lp->nlinks == lp->size)
+                lp->links = srealloc(lp->links, (lp->size = 2*lp->size+8)*
+                                     sizeof(*lp->links));
+        lp->links[lp->nlinks++] = epp;
+        return epp;
+}
+
+/* Decode a lambda expression. */
+static struct lambda *
+getlam(decoder_t *dp)
+{
+        exp_t *parp, *body;
+
+        parp = faslgetexp(dp);
+        body = faslgetexp(dp);
+        return nlam(parp, body, faslgetint(dp, 1) ? faslgetexp(dp) : NULL,
+                    NULL);
+}
+
+static evproc_t *getnode(decoder_t *, struct linked *);
+
+/* Decode n nodes in a NULL-terminated array. */
+static evproc_t **
+getvec(decoder_t *dp, struct linked *lp, int n)
+{
+        evproc_t **v;
+        int i;
+
+        v = smalloc((n+1)*sizeof(*v));
+        for (i = 0; i < n; i++)
+                v[i] = getnode(dp, lp);
+        v[n] = NULL;
+        return v;
+}
+
+/* Decode a node, adding those relying on global names to lp. */
+static evproc_t *
+getnode(decoder_t *dp, struct linked *lp)
+{
+        evproc_t **v, *op, *a;
+        struct prim *pp;
+        struct inl *ip;
+        struct vals *vp;
+        struct module *mp;
+        place_t pl;
+        int k, n, i;
+
+        switch (k = faslgetint(dp, NKINDS-1)) {
+        case NSELF:
+                return nevproc(evself, faslgetint(dp, 1) ? faslgetexp(dp) :
+                               NULL);
+        case NVAR:
+        case NIMPORT:
+                return nevproc(nodes[k], faslgetexp(dp));
+        case NDEF:
+                v = smalloc(2*sizeof(*v));
+                v[0] = (void *)faslgetsym(dp);
+                v[1] = getnode(dp, lp);
+                return nevproc(evdef, v);
+        case NSET:
+                v = smalloc(2*sizeof(*v));
+                v[0] = (void *)atom(faslgetsym(dp));
+                v[1] = getnode(dp, lp);
+                return nevproc(evset, v);
+        case NSETPAIR:
+                v = smalloc(3*sizeof(*v));
+                pl = faslgetint(dp, 1) ? CAR : CDR;
+                v[0] = (evproc_t *)pl;
+                v[1] = getnode(dp, lp);
+                v[2] = getnode(dp, lp);
+                return nevproc(evsetpair, v);
+        case NIF:
+                v = smalloc(3*sizeof(*v));
+                v[0] = getnode(dp, lp);
+                v[1] = getnode(dp, lp);
+                v[2] = getnode(dp, lp);
+                return nevproc(evif, v);
+        case NCOND:
+                n = faslgetint(dp, INT_MAX-1);
+                v = smalloc((n+1)*sizeof(*v));
+                for (i = 0; i < n; i++)
+                        switch (faslgetint(dp, 2)) {
+                        case 1:
+                                v[i] = keywords[ELSE];
+                                break;
+                        case 2:
+                                v[i] = keywords[ARROW];
+                                break;
+                        default:
+                                v[i] = getnode(dp, lp);
+                                break;
+                        }
+                v[n] = NULL;
+                return nevproc(evcond, v);
+        case NBEGIN:
+        case NAND:
+        case NOR:
+        case NAPP:
+                v = getvec(dp, lp, faslgetint(dp, INT_MAX-1));
+                return nevproc(nodes[k], v);
+        case NLAMBDA:
+                return addlink(lp, nevproc(evlambda, getlam(dp)));
+        case NBINAPP:
+                op = getnode(dp, lp);
+                a = getnode(dp, lp);
+                return nbinapp(op, a, getnode(dp, lp));
+        case NINLINE:
+                NEW(ip);
+                ip->name = faslgetsym(dp);
+                ip->argc = faslgetint(dp, INT_MAX-1);
+                ip->rands = getvec(dp, lp, ip->argc);
+                ip->op = getnode(dp, lp);
+                ip->lamp = NULL;
+                ip->ver = 0;
+                return addlink(lp, nevproc(evinline, ip));
+        case NVALUES:
+                NEW(vp);
+                vp->name = faslgetsym(dp);
+                vp->argc = faslgetint(dp, INT_MAX-1);
+                vp->rands = getvec(dp, lp, vp->argc);
+                vp->app = getnode(dp, lp);
+                vp->ver = 0;
+                return addlink(lp, nevproc(evvalues, vp));
+        case NMODULE:
+                NEW(mp);
+                mp->name = faslgetsym(dp);
+                mp->exports = faslgetexp(dp);
+                mp->imports = faslgetexp(dp);
+                mp->lamp = getlam(dp);
+                mp->vals = NULL;
+                mp->next = NULL;
+                return nevproc(evmodule, mp);
+        default:        /* inlined intrinsic */
+                NEW(pp);
+                pp->name = faslgetsym(dp);
+                n = faslgetint(dp, 2);
+                pp->rand[0] = getnode(dp, lp);
+                pp->rand[1] = n == 2 ? getnode(dp, lp) : NULL;
+                pp->app = napp(nevproc(evvar, atom(pp->name)), n, pp->rand);
+                pp->ver = 0;
+                return addlink(lp, nevproc(nodes[k], pp));
+        }
+}
+
+/* Decode an evaluation procedure encoded by putproc. */
+evproc_t *
+getproc(decoder_t *dp)
+{
+        struct linked *lp;
+
+        NEW(lp);
+        lp->nlinks = lp->size = 0;
+        lp->links = NULL;
+        lp->body = getnode(dp, lp);
+        if (lp->nlinks == 0)
+                return lp->body;
+        return nevproc(evlinked, lp);
 }
@@ -4,8 +4,17 @@
 extern const excpt_t eval_error;
 extern const excpt_t syntax_error;
 
+extern int eager;
+
 extern exp_t *eval(exp_t *, env_t *);
+extern evproc_t *toproc(exp_t *);
+extern exp_t *evalproc(evproc_t *, env_t *);
 extern exp_t *apply(exp_t *, exp_t *);
+extern exp_t *evcached(exp_t *, env_t *);
+extern exp_t *compile(exp_t *, env_t *);
+extern exp_t *values(exp_t *);
+extern exp_t *callvals(exp_t *, exp_t *);
+extern exp_t *listvals(exp_t *);
 
 #define everr(msg, ep)	RAISE1(eval_error, msg" %s", tostr(ep))
 #define anerr(msg, ep)  RAISE1(syntax_error, msg" %s", tostr(ep))
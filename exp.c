@@ -1,3 +1,6 @@
+#include <float.h>
+#include <math.h>
+
 #include "extern.h"
 #include "exp.h"
 #include "env.h"
@@ -6,8 +9,6 @@ exp_t *false;
 exp_t *true;
 exp_t *null;
 exp_t *undefined;               /* value of undefined variables. */
-exp_t *unquote;
-exp_t *splice;
 
 #define X(k, s)	s
 void *keywords[] = { KEYWORDS };
@@ -21,18 +22,21 @@ instcst(struct env *envp)
         false = bool("#f");
         null = atom("()");
         undefined = atom("*undefined*");
-        unquote = atom("*unquote*");
-        splice = atom("*splice*");
 }
 
-/* Transform the strings in keywords into symbol expressions. */
+/*
+ * Transform the strings in keywords into symbol expressions and tag
+ * each symbol with its syntax class.
+ */
 void
 initkeys(void)
 {
         register int i;
 
-        for (i = 0; i < NELEMS(keywords); i++)
+        for (i = 0; i < NELEMS(keywords); i++) {
                 keywords[i] = atom(keywords[i]);
+                atmsyn(symp((exp_t *)keywords[i])) = i+1;
+        }
 }
 
 /* Return true if the two expressions occupy the same memory.*/
@@ -42,150 +46,176 @@ iseq(const exp_t *a, const exp_t *b)
         return symp(a) == symp(b);
 }
 
-/* Return a string representing an atom */
-static char *
-atmtostr(const exp_t *ep)
-{
-        char *s;
-        size_t len;
-
-        len = strlen(symp(ep))+1;
-        s = xalloc(len);
-        memcpy(s, symp(ep), len);
-        return s;
-}
-
-/* Return a string representing a pair */
-static char *
-pairtostr(const exp_t *ep)
+/*
+ * Printer of the expressions.
+ *
+ * An expression is printed in a single pass into a growable buffer.
+ * The lists are walked without recursion, the rests of the lists
+ * being printed are kept on a stack, so that the time is linear in
+ * the size of the expression whatever its length or its depth.  When
+ * the output goes to a file, the buffer is flushed as it fills up.
+ */
+#define PRFLUSH 4096            /* size of the output flushed to a file */
+#define DBLDIGS 17              /* digits identifying any double */
+
+struct printer {
+        buf_t  *bp;             /* output */
+        FILE   *fp;             /* file where it is flushed or NULL */
+};
+
+/* Append len bytes from s to the output. */
+static inline void
+pwrite(struct printer *pp, const char *s, int len)
 {
-        char *buf, *car, *cdr;
-        size_t size;
-
-        car = tostr(car(ep));
-        size = strlen(car)+3;
-        if (isnull(cdr(ep))) {
-                buf = xalloc(size);
-                snprintf(buf, size, "(%s)", car);
-                goto clean;
+        bwrite(pp->bp, s, len);
+        if (pp->fp != NULL && pp->bp->len >= PRFLUSH) {
+                fwrite(pp->bp->buf, 1, pp->bp->len, pp->fp);
+                pp->bp->len = 0;
         }
-        cdr = tostr(cdr(ep));
-        if (ispair(cdr(ep))) {
-                size_t len = strlen(cdr)-2; /* ignore parenthesis */
-                size += len+1;
-                buf = xalloc(size);
-                snprintf(buf, size, "(%s %.*s)", car, len, cdr+1);
-        } else {
-                size += strlen(cdr)+3;
-                buf = xalloc(size);
-                snprintf(buf, size, "(%s . %s)", car, cdr);
-        }
-        xfree(cdr);
-clean:
-        xfree(car);
-        return buf;
-}
-
-/* Return a string representing a procedure */
-static char *
-proctostr(const exp_t *ep)
-{
-        static char pref[] = "#<procedure";
-        char *buf;
-        size_t size;
-
-        size = sizeof(pref)+(label(ep) ? strlen(label(ep)) : 0)+2;
-        buf = xalloc(size);
-        if (label(ep))
-                snprintf(buf, size, "%s:%s>", pref, label(ep));
-        else
-                snprintf(buf, size, "%s>", pref);
-        return buf;
-}
-
-/* Return a string representing a float */
-static char *
-ftostr(const exp_t *ep)
-{
-        char *buf = xalloc(FMAXDIG);
-
-        snprintf(buf, FMAXDIG, "%e", flt(ep));
-        return buf;
 }
 
-/* Return a string representing a rational. */
-static char *
-rtostr(const exp_t *ep)
+#define pputs(pp, s)	pwrite(pp, s, strlen(s))
+#define pputc(pp, c)	do {                    \
+                char ch = (c);                  \
+                pwrite(pp, &ch, 1);             \
+        } while (0)
+
+/*
+ * Write in buf the shortest string representing a float that reads
+ * back as the same float and return its length.  Any decimal of at
+ * most DBL_DIG digits is read back unchanged as a normal float, so the
+ * shortest one is found by trying the precisions from DBL_DIG up, or
+ * from 1 for the subnormal ones.
+ */
+static int
+ftostr(char *buf, size_t size, double d)
 {
-        char *buf = xalloc(2*IMAXDIG+2);
-
-        sprintf(buf, "%d/%d", num(ep), den(ep));
-        return buf;
+        int prec;
+
+        if (isnan(d))
+                return snprintf(buf, size, "+nan.0");
+        if (isinf(d))
+                return snprintf(buf, size, d > 0 ? "+inf.0" : "-inf.0");
+        prec = (fabs(d) < DBL_MIN ? 1 : DBL_DIG);
+        for (; prec < DBLDIGS; prec++) {
+                snprintf(buf, size, "%.*g", prec, d);
+                if (strtod(buf, NULL) == d)
+                        break;
+        }
+        if (prec == DBLDIGS)
+                snprintf(buf, size, "%.*g", prec, d);
+        if (strpbrk(buf, ".e") == NULL)
+                strcat(buf, ".0");      /* still a float when read */
+        return strlen(buf);
 }
 
-/* Return a string representing a fixnum. */
-static char *
-fxntostr(const exp_t *ep)
+/* Print an expression that isn't a pair. */
+static void
+patom(struct printer *pp, const exp_t *ep)
 {
-        char *buf = xalloc(IMAXDIG+1);
+        char buf[FMAXDIG+1];
 
-        sprintf(buf, "%d", fixnum(ep));
-        return buf;
+        if (isatom(ep) || isbool(ep))
+                pputs(pp, symp(ep));
+        else if (isproc(ep)) {
+                pputs(pp, "#<procedure");
+                if (label(ep)) {
+                        pputc(pp, ':');
+                        pputs(pp, label(ep));
+                }
+                pputc(pp, '>');
+        } else if (isfloat(ep))
+                pwrite(pp, buf, ftostr(buf, sizeof(buf), flt(ep)));
+        else if (israt(ep))
+                pwrite(pp, buf, snprintf(buf, sizeof(buf), "%d/%d", num(ep),
+                                         den(ep)));
+        else if (isfxn(ep))
+                pwrite(pp, buf, snprintf(buf, sizeof(buf), "%d",
+                                         fixnum(ep)));
+        else if (ischar(ep)) {
+                switch (char(ep)) {
+                case '\n':
+                        pputs(pp, "#\\newline");
+                        break;
+                case ' ':
+                        pputs(pp, "#\\space");
+                        break;
+                default:
+                        pputs(pp, "#\\");
+                        pputc(pp, char(ep));
+                        break;
+                }
+        } else if (isstr(ep)) {
+                pputc(pp, '"');
+                pwrite(pp, str(ep), slen(ep));
+                pputc(pp, '"');
+        } else
+                err_quit("tostr: unknown expression");
 }
 
-/* Return a string representing a char. */
-static char *
-ctostr(const exp_t *ep)
+/* Print an expression. */
+static void
+pexp(struct printer *pp, const exp_t *ep)
 {
-        static char buf[10];
-
-        switch (char(ep)) {
-        case '\n':
-                sprintf(buf, "#\\newline");
-                break;
-        case ' ':
-                sprintf(buf, "#\\space");
-                break;
-        default:
-                sprintf(buf, "#\\%c", char(ep));
-                break;
+        const exp_t **stack = NULL;     /* rests of the lists */
+        size_t n = 0, size = 0;
+
+        for (;;) {
+                for (; ispair(ep); ep = car(ep)) {
+                        if (n == size) {
+                                size = size ? 2*size : 32;
+                                stack = srealloc(stack, size*sizeof(*stack));
+                        }
+                        stack[n++] = cdr(ep);
+                        pputc(pp, '(');
+                }
+                patom(pp, ep);
+                for (;;) {
+                        if (n == 0) {
+                                free(stack);
+                                return;
+                        }
+                        ep = stack[--n];
+                        if (isnull(ep))
+                                pputc(pp, ')');
+                        else if (ispair(ep)) {
+                                stack[n++] = cdr(ep);
+                                pputc(pp, ' ');
+                                ep = car(ep);
+                                break;
+                        } else {
+                                pwrite(pp, " . ", 3);
+                                patom(pp, ep);
+                                pputc(pp, ')');
+                        }
+                }
         }
-        return buf;
 }
 
-/* Return a string representing a string. */
-static char *
-stostr(const exp_t *ep)
+/* Return a string representing the expression */
+char *
+tostr(const exp_t *ep)
 {
-        char *buf = xalloc(slen(ep)+2);
+        struct printer p;
 
-        sprintf(buf, "\"%s\"", str(ep));
-        return buf;
+        p.bp = binit();
+        p.fp = NULL;
+        pexp(&p, ep);
+        bputc('\0', p.bp);
+        return p.bp->buf;
 }
 
-/* Return a string representing the expression */
-char *
-tostr(const exp_t *ep)
+/* Write the expression to the file fp. */
+void
+fputexp(const exp_t *ep, FILE *fp)
 {
-        if (isatom(ep) || isbool(ep))
-                return atmtostr(ep);
-        else if (ispair(ep))
-                return pairtostr(ep);
-        else if (isproc(ep))
-                return proctostr(ep);
-        else if (isfloat(ep))
-                return ftostr(ep);
-        else if (israt(ep))
-                return rtostr(ep);
-        else if (isfxn(ep))
-                return fxntostr(ep);
-        else if (ischar(ep))
-                return ctostr(ep);
-        else if (isstr(ep))
-                return stostr(ep);
-        else
-                err_quit("tostr: unknown expression");
-        return NULL;
+        struct printer p;
+
+        p.bp = binit();
+        p.fp = fp;
+        pexp(&p, ep);
+        fwrite(p.bp->buf, 1, p.bp->len, fp);
+        bfree(p.bp);
 }
 
 #define SIGN(x) ((x) < 0 ? -1 : 1)
@@ -68,26 +68,36 @@ typedef struct evproc {
         void *argv;
 } evproc_t;
 
-struct func {                   /* Represents a function */
+struct lambda {                 /* Represents a lambda expression */
         exp_t      *parp;       /* Parameters of the function */
-        evproc_t   *bodyp;      /* body of the function */
-        struct env *envp;       /* environment of the function */
+        exp_t      *body;       /* body to analyze on the first call */
+        exp_t      *scope;      /* variables bound around the lambda */
+        evproc_t   *bodyp;      /* body of the function or NULL */
+        int         nlocals;    /* parameters and internal definitions */
+};
+
+struct func {                   /* Represents a function */
+        struct lambda *lamp;    /* lambda expression of the function */
+        struct env    *envp;    /* environment of the function */
 };
 
 #define ptype(ep)       procp(ep)->tp
 #define primp(ep)       procp(ep)->u.primp
 #define funcp(ep)       procp(ep)->u.funcp
-#define fpar(ep)        funcp(ep)->parp
-#define fbody(ep)       funcp(ep)->bodyp
+#define contp(ep)       procp(ep)->u.contp
+#define flam(ep)        funcp(ep)->lamp
+#define fpar(ep)        flam(ep)->parp
+#define fbody(ep)       flam(ep)->bodyp
 #define fenv(ep)        funcp(ep)->envp
 
-enum ftype { FUNC, PRIM };
+enum ftype { FUNC, PRIM, CONT };
 typedef struct proc {           /* A procedure is a function or a primitive */
         enum ftype tp;          /* type of the procedure */
         symb_t *label;          /* label of the procedure */
         union {
                 exp_t *(*primp)();  /* pointer to a primitive function */
                 struct func *funcp; /* pointer to an user-defined function */
+                struct cont *contp; /* pointer to a continuation */
         } u;
 } proc_t;
 
@@ -111,8 +121,6 @@ extern exp_t *false;
 extern exp_t *true;
 extern exp_t *null;
 extern exp_t *undefined;
-extern exp_t *unquote;
-extern exp_t *splice;
 
 #define KEYWORDS                                \
                 X(DEFINE, "define"),            \
@@ -120,10 +128,16 @@ extern exp_t *splice;
                 X(IF, "if"),                    \
                 X(BEGIN, "begin"),              \
                 X(COND, "cond"),                \
+                X(CASE, "case"),                \
                 X(LAMBDA, "lambda"),            \
                 X(AND, "and"),                  \
                 X(OR, "or"),                    \
                 X(LET, "let"),                  \
+                X(DO, "do"),                    \
+                X(RECEIVE, "receive"),          \
+                X(MODULE, "define-module"),     \
+                X(EXPORT, "export"),            \
+                X(IMPORT, "import"),            \
                 X(SET, "set!"),                 \
                 X(SETCAR, "set-car!"),          \
                 X(SETCDR, "set-cdr!"),          \
@@ -142,6 +156,7 @@ extern void initkeys(void);
 
 extern int iseq(const exp_t *, const exp_t *);
 extern char *tostr(const exp_t *);
+extern void  fputexp(const exp_t *, FILE *);
 extern void instcst(struct env *);
 extern exp_t *nrat(int, int);
 
@@ -168,6 +183,18 @@ atom(symb_t *s)
         return ep;
 }
 
+/* Return an atom whose symbol is the sequence of len bytes s. */
+static inline exp_t *
+natm(const char *s, int len)
+{
+        exp_t *ep;
+
+        NEW(ep);
+        ep->tp = ATOM;
+        ep->u.sp = natom(s, len);
+        return ep;
+}
+
 /* Return a boolean whose symbol is s. */
 static inline exp_t *
 bool(symb_t *s)
@@ -205,16 +232,30 @@ nevproc(exp_t *(*eval)(), void *argv)
         return epp;
 }
 
+/* Return a lambda expression */
+static inline struct lambda *
+nlam(exp_t *parp, exp_t *body, exp_t *scope, evproc_t *bodyp)
+{
+        struct lambda *lp;
+
+        NEW(lp);
+        lp->parp = parp;
+        lp->body = body;
+        lp->scope = scope;
+        lp->bodyp = bodyp;
+        lp->nlocals = 0;
+        return lp;
+}
+
 /* Return a function */
 static inline proc_t *
-nfunc(exp_t *parp, evproc_t *bodyp, struct env *envp)
+nfunc(struct lambda *lamp, struct env *envp)
 {
         struct func *fp;
         proc_t *pp;
 
         NEW(fp);
-        fp->parp = parp;
-        fp->bodyp = bodyp;
+        fp->lamp = lamp;
         fp->envp = envp;
 
         NEW(pp);
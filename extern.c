@@ -1,3 +1,5 @@
+#include <unistd.h>
+
 #include "extern.h"
 
 int   linenum  = 1;             /* line being read */
@@ -58,3 +60,12 @@ sstrndup(const char *s, size_t n)
         *(d+n) = '\0';
         return d;
 }
+
+/* Return the number of processors online. */
+int
+ncpus(void)
+{
+        long n;
+
+        return ((n = sysconf(_SC_NPROCESSORS_ONLN)) > 0 ? n : 1);
+}
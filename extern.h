@@ -42,6 +42,7 @@ extern void *scalloc(size_t, size_t);
 extern void *srealloc(void *, size_t);
 extern char *sstrdup(const char *);
 extern char *sstrndup(const char *, size_t);
+extern int   ncpus(void);
 
 static inline int
 issep(int c)
@@ -75,12 +76,15 @@ binit(void)
 
 #define bwrite(bp, s, len)	_bwrite(&(bp), s, len)
 
-/* Write len bytes from s into the buffer. */
+/*
+ * Write len bytes from s into the buffer.  Its size is doubled when
+ * it's full so that filling it takes linear time.
+ */
 static inline void
-_bwrite(buf_t **p, char *s, int len)
+_bwrite(buf_t **p, const char *s, int len)
 {
-        while ((*p)->len+len > (*p)->size)
-                *p = bresize(*p, (*p)->size+BSIZ);
+        if ((*p)->len+len > (*p)->size)
+                *p = bresize(*p, 2*((*p)->size+len));
         memcpy((*p)->buf+(*p)->len, s, len);
         (*p)->len += len;
 }
@@ -92,7 +96,7 @@ static inline void
 _bputc(int c, buf_t **p)
 {
         if ((*p)->len == (*p)->size)
-                *p = bresize(*p, (*p)->size+BSIZ);
+                *p = bresize(*p, 2*(*p)->size);
         (*p)->buf[(*p)->len++] = c;
 }
 
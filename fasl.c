@@ -0,0 +1,635 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "extern.h"
+#include "exp.h"
+#include "type.h"
+#include "fasl.h"
+
+/*
+ * Compiled files.
+ *
+ * The forms read from a source file are saved in a compiled file so
+ * that the next loads of the source don't have to parse it again.  A
+ * compiled file starts with a header identifying its source by path,
+ * modification time and size, followed by the encoded forms and their
+ * position in the source.  Each symbol is written once and referred
+ * to by its index afterwards.
+ *
+ * A form is saved as its evaluation procedure when all its nodes can
+ * be encoded (see putproc), so that it isn't analyzed either when it's
+ * loaded.  The other forms are saved as expressions.
+ */
+
+#define MAGIC   "LOOTFASL"
+
+enum { FFORM, FPROC, FEND, FNULL, FTRUE, FFALSE, FSYM, FSREF, FFIX, FFLT,
+       FRAT, FCHAR, FSTR, FLIST };
+
+#define SUFFIX  ".fasl"
+
+/* Return the path of the compiled file of the source, to be freed. */
+static char *
+faslpath(char *path)
+{
+        char *dir, *buf, *p;
+        size_t size;
+
+        dir = getenv(FASLDIR);
+        size = (dir ? strlen(dir)+1 : 0) + strlen(path) + sizeof(SUFFIX);
+        buf = smalloc(size);
+        if (dir == NULL) {
+                snprintf(buf, size, "%s%s", path, SUFFIX);
+                return buf;
+        }
+        snprintf(buf, size, "%s/%s%s", dir, path, SUFFIX);
+        for (p = buf+strlen(dir)+1; *p; p++)
+                if (*p == '/')
+                        *p = '%';
+        return buf;
+}
+
+/* Write n bytes from s at the end of the compiled forms. */
+static void
+put(fasl_t *fp, const void *s, size_t n)
+{
+        if (fp->len+n > fp->bsize) {
+                while (fp->len+n > fp->bsize)
+                        fp->bsize = 2*fp->bsize+BUFSIZ;
+                fp->buf = srealloc(fp->buf, fp->bsize);
+        }
+        memcpy(fp->buf+fp->len, s, n);
+        fp->len += n;
+}
+
+/* Write a tag. */
+static inline void
+puttag(fasl_t *fp, char tag)
+{
+        put(fp, &tag, 1);
+}
+
+/* Write an integer. */
+static inline void
+putint(fasl_t *fp, int n)
+{
+        put(fp, &n, sizeof(n));
+}
+
+/* Write the symbol s or a reference to it if it was already written. */
+static void
+putsym(fasl_t *fp, symb_t *s)
+{
+        unsigned long h;
+        int i;
+
+        if (2*(fp->nsyms+1) > fp->symsize) {
+                symb_t **syms = fp->syms;
+                int *ids = fp->ids, size = fp->symsize;
+
+                fp->symsize = size ? 2*size : 64;
+                fp->syms = scalloc(fp->symsize, sizeof(*fp->syms));
+                fp->ids = smalloc(fp->symsize*sizeof(*fp->ids));
+                for (i = 0; i < size; i++)
+                        if (syms[i]) {
+                                h = (unsigned long)syms[i] >> 3;
+                                while (fp->syms[h &= fp->symsize-1])
+                                        h++;
+                                fp->syms[h] = syms[i];
+                                fp->ids[h] = ids[i];
+                        }
+                free(syms);
+                free(ids);
+        }
+        for (h = (unsigned long)s >> 3; fp->syms[h &= fp->symsize-1]; h++)
+                if (fp->syms[h] == s) {
+                        puttag(fp, FSREF);
+                        putint(fp, fp->ids[h]);
+                        return;
+                }
+        fp->syms[h] = s;
+        fp->ids[h] = fp->nsyms++;
+        puttag(fp, FSYM);
+        putint(fp, strlen(s));
+        put(fp, s, strlen(s));
+}
+
+/* Encode an expression that isn't a pair. */
+static void
+putatom(fasl_t *fp, exp_t *ep)
+{
+        double x;
+
+        if (isatom(ep) && isnull(ep))
+                puttag(fp, FNULL);
+        else if (ep == true)
+                puttag(fp, FTRUE);
+        else if (ep == false)
+                puttag(fp, FFALSE);
+        else switch (type(ep)) {
+        case ATOM:
+                putsym(fp, symp(ep));
+                break;
+        case FIXNUM:
+                puttag(fp, FFIX);
+                putint(fp, fixnum(ep));
+                break;
+        case FLOAT:
+                puttag(fp, FFLT);
+                x = flt(ep);
+                put(fp, &x, sizeof(x));
+                break;
+        case RAT:
+                puttag(fp, FRAT);
+                putint(fp, num(ep));
+                putint(fp, den(ep));
+                break;
+        case CHAR:
+                puttag(fp, FCHAR);
+                put(fp, &char(ep), 1);
+                break;
+        case STRING:
+                puttag(fp, FSTR);
+                putint(fp, slen(ep));
+                put(fp, str(ep), slen(ep));
+                break;
+        default:                /* not produced by the reader */
+                fp->ok = 0;
+                break;
+        }
+}
+
+/*
+ * Encode the expression.  A list is encoded as its length, its
+ * elements and its tail.  The lists being encoded are kept on a
+ * stack, like in the printer, so that deep data doesn't overflow the
+ * C one.
+ */
+static void
+putexp(fasl_t *fp, exp_t *ep)
+{
+        exp_t **stack = NULL;   /* pairs whose car is being encoded */
+        size_t n = 0, size = 0;
+        exp_t *p;
+        int len;
+
+        for (;;) {
+                for (; ispair(ep); ep = car(ep)) {
+                        for (len = 0, p = ep; ispair(p); p = cdr(p))
+                                len++;
+                        puttag(fp, FLIST);
+                        putint(fp, len);
+                        if (n == size) {
+                                size = size ? 2*size : 32;
+                                stack = srealloc(stack, size*sizeof(*stack));
+                        }
+                        stack[n++] = ep;
+                }
+                putatom(fp, ep);
+                for (;;) {
+                        if (n == 0) {
+                                free(stack);
+                                return;
+                        }
+                        ep = cdr(stack[n-1]);
+                        if (ispair(ep)) {
+                                stack[n-1] = ep;
+                                ep = car(ep);
+                                break;
+                        }
+                        n--;
+                        putatom(fp, ep); /* tail of the list */
+                }
+        }
+}
+
+/* Write an integer for putproc. */
+void
+faslputint(fasl_t *fp, int n)
+{
+        putint(fp, n);
+}
+
+/* Write a symbol for putproc. */
+void
+faslputsym(fasl_t *fp, symb_t *s)
+{
+        putsym(fp, s);
+}
+
+/* Write an expression for putproc. */
+void
+faslputexp(fasl_t *fp, exp_t *ep)
+{
+        putexp(fp, ep);
+}
+
+/* Return a new compiled file for the source in path. */
+fasl_t *
+faslnew(char *path)
+{
+        struct stat st;
+        fasl_t *fp;
+        int n;
+
+        NEW(fp);
+        fp->nforms = 0;
+        fp->forms = NULL;
+        fp->procs = NULL;
+        fp->lines = fp->cols = NULL;
+        fp->pend = NULL;
+        fp->buf = NULL;
+        fp->len = fp->bsize = 0;
+        fp->ok = stat(path, &st) == 0;
+        fp->mtime = fp->ok ? st.st_mtime : 0;
+        fp->size = fp->ok ? st.st_size : 0;
+        fp->syms = NULL;
+        fp->ids = NULL;
+        fp->nsyms = fp->symsize = 0;
+
+        put(fp, MAGIC, strlen(MAGIC));
+        putint(fp, FASLVER);
+        put(fp, &fp->mtime, sizeof(fp->mtime));
+        put(fp, &fp->size, sizeof(fp->size));
+        n = strlen(path);
+        putint(fp, n);
+        put(fp, path, n);
+        return fp;
+}
+
+/* Encode the pending form as an expression. */
+static void
+putform(fasl_t *fp)
+{
+        puttag(fp, FFORM);
+        put(fp, &fp->pline, sizeof(fp->pline));
+        put(fp, &fp->pcol, sizeof(fp->pcol));
+        putexp(fp, fp->pend);
+        fp->pend = NULL;
+}
+
+/*
+ * Add a form read at line and col to the compiled file.  It's encoded
+ * once it's analyzed (see faslproc), or as an expression if the
+ * analysis fails.
+ */
+void
+faslput(fasl_t *fp, exp_t *ep, unsigned line, unsigned col)
+{
+        if (fp->pend)
+                putform(fp);
+        fp->pend = ep;
+        fp->pline = line;
+        fp->pcol = col;
+}
+
+/* Encode the last form added by its evaluation procedure if possible. */
+void
+faslproc(fasl_t *fp, evproc_t *epp)
+{
+        if (fp->pend == NULL)
+                return;
+        if (!isportable(epp)) {
+                putform(fp);
+                return;
+        }
+        puttag(fp, FPROC);
+        put(fp, &fp->pline, sizeof(fp->pline));
+        put(fp, &fp->pcol, sizeof(fp->pcol));
+        putproc(fp, epp);
+        fp->pend = NULL;
+}
+
+/*
+ * Write the compiled file of the source in path, unless a form
+ * couldn't be encoded or the source changed since it was read.  It's
+ * written in a temporary file first, so that another process never
+ * sees a partial file.
+ */
+void
+faslsave(fasl_t *fp, char *path)
+{
+        char *cpath, *tmp;
+        struct stat st;
+        FILE *out;
+        size_t n;
+        int ok;
+
+        if (!fp->ok || stat(path, &st) != 0 || st.st_mtime != fp->mtime ||
+            st.st_size != fp->size)
+                return;
+        if (fp->pend)
+                putform(fp);
+        puttag(fp, FEND);
+        cpath = faslpath(path);
+        n = strlen(cpath) + 3*sizeof(long) + 2;
+        tmp = smalloc(n);
+        snprintf(tmp, n, "%s.%ld", cpath, (long)getpid());
+        if ((out = fopen(tmp, "w")) != NULL) {  /* else don't compile */
+                ok = fwrite(fp->buf, 1, fp->len, out) == fp->len;
+                if (fclose(out) != 0 || !ok || rename(tmp, cpath) != 0)
+                        unlink(tmp);
+        }
+        free(cpath);
+        free(tmp);
+}
+
+/* Free the compiled file but not its forms. */
+void
+faslfree(fasl_t *fp)
+{
+        free(fp->forms);
+        free(fp->procs);
+        free(fp->lines);
+        free(fp->cols);
+        free(fp->buf);
+        free(fp->syms);
+        free(fp->ids);
+        free(fp);
+}
+
+struct decoder {                /* state of the decoding of a file */
+        const char  *p;         /* next byte to decode */
+        const char  *end;       /* end of the file */
+        symb_t     **syms;      /* symbols decoded so far */
+        int          nsyms;
+        int          size;      /* size of syms */
+        int          bad;       /* is the file corrupted? */
+};
+
+/* Copy the next n bytes into s. */
+static void
+get(decoder_t *dp, void *s, size_t n)
+{
+        if (dp->bad || (size_t)(dp->end-dp->p) < n) {
+                dp->bad = 1;
+                memset(s, 0, n);
+                return;
+        }
+        memcpy(s, dp->p, n);
+        dp->p += n;
+}
+
+/* Return the next integer. */
+static int
+getint(decoder_t *dp)
+{
+        int n;
+
+        get(dp, &n, sizeof(n));
+        return n;
+}
+
+/* Return the next n bytes as a string or NULL. */
+static const char *
+getstr(decoder_t *dp, int n)
+{
+        const char *s = dp->p;
+
+        if (dp->bad || n < 0 || dp->end-dp->p < n) {
+                dp->bad = 1;
+                return NULL;
+        }
+        dp->p += n;
+        return s;
+}
+
+/* Decode an expression that isn't a list whose tag is c. */
+static exp_t *
+getatom(decoder_t *dp, char c)
+{
+        const char *s;
+        double x;
+        int n, d;
+
+        switch (dp->bad ? -1 : c) {
+        case FNULL:
+                return null;
+        case FTRUE:
+                return true;
+        case FFALSE:
+                return false;
+        case FSYM:
+                n = getint(dp);
+                if ((s = getstr(dp, n)) == NULL)
+                        return null;
+                if (dp->nsyms == dp->size)
+                        dp->syms = srealloc(dp->syms, (dp->size = 2*dp->size+64)*
+                                            sizeof(*dp->syms));
+                dp->syms[dp->nsyms++] = natom(s, n);
+                return atom(dp->syms[dp->nsyms-1]);
+        case FSREF:
+                if ((n = getint(dp)) < 0 || n >= dp->nsyms)
+                        break;
+                return atom(dp->syms[n]);
+        case FFIX:
+                return nfixnum(getint(dp));
+        case FFLT:
+                get(dp, &x, sizeof(x));
+                return nfloat(x);
+        case FRAT:
+                n = getint(dp);
+                if ((d = getint(dp)) == 0)
+                        break;
+                return nrat(n, d);
+        case FCHAR:
+                get(dp, &c, 1);
+                return nchar(c);
+        case FSTR:
+                n = getint(dp);
+                if ((s = getstr(dp, n)) == NULL)
+                        return null;
+                return nstr(s, n);
+        }
+        dp->bad = 1;
+        return null;
+}
+
+/* Decode an expression, keeping the lists being decoded on a stack. */
+static exp_t *
+getexp(decoder_t *dp)
+{
+        struct {
+                exp_t   *head;          /* elements decoded so far */
+                exp_t   *last;
+                int      left;          /* number of elements to decode */
+        } *stack = NULL;
+        size_t n = 0, size = 0;
+        exp_t *ep;
+        char c;
+        int len;
+
+        for (;;) {
+                get(dp, &c, 1);
+                if (!dp->bad && c == FLIST) {
+                        if ((len = getint(dp)) <= 0) {
+                                dp->bad = 1;
+                                ep = null;
+                        } else {
+                                if (n == size) {
+                                        size = size ? 2*size : 32;
+                                        stack = srealloc(stack,
+                                                         size*sizeof(*stack));
+                                }
+                                stack[n].head = stack[n].last = NULL;
+                                stack[n++].left = len;
+                                continue;
+                        }
+                } else
+                        ep = getatom(dp, c);
+
+                /* Add the expression to the enclosing lists. */
+                for (; n > 0 && !dp->bad; n--) {
+                        if (stack[n-1].left-- > 0) {
+                                ep = cons(ep, null);
+                                if (stack[n-1].last)
+                                        cdr(stack[n-1].last) = ep;
+                                else
+                                        stack[n-1].head = ep;
+                                stack[n-1].last = ep;
+                                break;
+                        }
+                        cdr(stack[n-1].last) = ep; /* tail of the list */
+                        ep = stack[n-1].head;
+                }
+                if (n == 0 || dp->bad) {
+                        free(stack);
+                        return dp->bad ? null : ep;
+                }
+        }
+}
+
+/*
+ * Return the next integer for getproc.  The file is corrupted if it's
+ * not between 0 and max.
+ */
+int
+faslgetint(decoder_t *dp, int max)
+{
+        int n;
+
+        if ((n = getint(dp)) < 0 || n > max) {
+                dp->bad = 1;
+                return 0;
+        }
+        return n;
+}
+
+/* Return the next symbol for getproc. */
+symb_t *
+faslgetsym(decoder_t *dp)
+{
+        exp_t *ep;
+
+        if (!isatom(ep = getexp(dp))) {
+                dp->bad = 1;
+                return strtoatm("");
+        }
+        return symp(ep);
+}
+
+/* Return the next expression for getproc. */
+exp_t *
+faslgetexp(decoder_t *dp)
+{
+        return getexp(dp);
+}
+
+/* Decode the forms of the compiled file and return zero on success. */
+static int
+getforms(decoder_t *dp, fasl_t *fp)
+{
+        int size;
+        char c;
+
+        for (size = 0;;) {
+                get(dp, &c, 1);
+                if (dp->bad || (c != FFORM && c != FPROC))
+                        break;
+                if (fp->nforms == size) {
+                        size = 2*size+16;
+                        fp->forms = srealloc(fp->forms,
+                                             size*sizeof(*fp->forms));
+                        fp->procs = srealloc(fp->procs,
+                                             size*sizeof(*fp->procs));
+                        fp->lines = srealloc(fp->lines,
+                                             size*sizeof(*fp->lines));
+                        fp->cols = srealloc(fp->cols, size*sizeof(*fp->cols));
+                }
+                get(dp, fp->lines+fp->nforms, sizeof(*fp->lines));
+                get(dp, fp->cols+fp->nforms, sizeof(*fp->cols));
+                fp->forms[fp->nforms] = c == FFORM ? getexp(dp) : NULL;
+                fp->procs[fp->nforms++] = c == FPROC ? getproc(dp) : NULL;
+        }
+        return dp->bad || c != FEND || dp->p != dp->end;
+}
+
+/*
+ * Return the forms of the compiled file of the source in path, or
+ * NULL if there's none or if it's out of date.  The compiled file is
+ * mapped in memory while it's decoded.
+ */
+fasl_t *
+faslload(char *path)
+{
+        char *cpath;
+        struct stat st, cst;
+        long long mtime, size;
+        decoder_t d;
+        fasl_t *fp;
+        void *map;
+        int fd, n;
+        const char *s;
+
+        if (stat(path, &st) != 0)
+                return NULL;
+        cpath = faslpath(path);
+        fd = open(cpath, O_RDONLY);
+        free(cpath);
+        if (fd < 0)
+                return NULL;
+        if (fstat(fd, &cst) != 0 || cst.st_size == 0 ||
+            (map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+            MAP_FAILED) {
+                close(fd);
+                return NULL;
+        }
+        close(fd);
+
+        d.p = map;
+        d.end = d.p+cst.st_size;
+        d.syms = NULL;
+        d.nsyms = d.size = d.bad = 0;
+        fp = NULL;
+        s = getstr(&d, strlen(MAGIC));
+        if (s == NULL || memcmp(s, MAGIC, strlen(MAGIC)) != 0 ||
+            getint(&d) != FASLVER)
+                goto done;
+        get(&d, &mtime, sizeof(mtime));
+        get(&d, &size, sizeof(size));
+        n = getint(&d);
+        if (mtime != st.st_mtime || size != st.st_size ||
+            n != (int)strlen(path) || (s = getstr(&d, n)) == NULL ||
+            memcmp(s, path, n) != 0)
+                goto done;
+
+        NEW(fp);
+        fp->nforms = 0;
+        fp->forms = NULL;
+        fp->procs = NULL;
+        fp->lines = fp->cols = NULL;
+        fp->pend = NULL;
+        fp->buf = NULL;
+        fp->syms = NULL;
+        fp->ids = NULL;
+        if (getforms(&d, fp)) {
+                faslfree(fp);
+                fp = NULL;
+        }
+done:
+        free(d.syms);
+        munmap(map, cst.st_size);
+        return fp;
+}
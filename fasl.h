@@ -0,0 +1,54 @@
+#ifndef FASL_H
+#define FASL_H
+
+/*
+ * Version of the compiled files.  It should be incremented whenever
+ * their format, the expressions returned by the reader or the nodes
+ * saved by putproc change.
+ */
+#define FASLVER         3
+#define FASLDIR         "LOOTCACHE"     /* directory of the compiled files */
+
+typedef struct fasl {           /* forms of a compiled file */
+        int        nforms;      /* number of forms */
+        exp_t    **forms;       /* the forms to analyze or NULL */
+        evproc_t **procs;       /* or their evaluation procedures */
+        unsigned  *lines;       /* position of each form in the source */
+        unsigned  *cols;
+        exp_t     *pend;        /* form added but not yet encoded */
+        unsigned   pline;       /* and its position */
+        unsigned   pcol;
+        char      *buf;         /* encoded forms while compiling */
+        size_t     len;         /* length of buf */
+        size_t     bsize;       /* size of buf */
+        int        ok;          /* can the compiled file be saved? */
+        long long  mtime;       /* modification time of the source */
+        long long  size;        /* and its size */
+        symb_t   **syms;        /* hash table of the symbols encoded */
+        int       *ids;         /* their index in the compiled file */
+        int        nsyms;       /* number of symbols encoded */
+        int        symsize;     /* size of the hash table */
+} fasl_t;
+
+typedef struct decoder decoder_t;
+
+extern fasl_t *faslload(char *);
+extern fasl_t *faslnew(char *);
+extern void    faslput(fasl_t *, exp_t *, unsigned, unsigned);
+extern void    faslproc(fasl_t *, evproc_t *);
+extern void    faslsave(fasl_t *, char *);
+extern void    faslfree(fasl_t *);
+
+/* Encoding of the parts of the evaluation procedures (see eval.c). */
+extern void    faslputint(fasl_t *, int);
+extern void    faslputsym(fasl_t *, symb_t *);
+extern void    faslputexp(fasl_t *, exp_t *);
+extern int     faslgetint(decoder_t *, int);
+extern symb_t *faslgetsym(decoder_t *);
+extern exp_t  *faslgetexp(decoder_t *);
+
+extern int       isportable(evproc_t *);
+extern void      putproc(fasl_t *, evproc_t *);
+extern evproc_t *getproc(decoder_t *);
+
+#endif /* !FASL_H */
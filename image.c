@@ -0,0 +1,581 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "extern.h"
+#include "exp.h"
+#include "env.h"
+#include "prim.h"
+#include "image.h"
+
+/*
+ * Heap images.
+ *
+ * An image is a snapshot of the objects reachable from the global
+ * environment: expressions, procedures, lambda expressions and
+ * environments.  Each object is numbered, and the pointers between
+ * objects are written as numbers, which are relocated to the objects
+ * allocated when the image is loaded.  The primitives are written by
+ * name and the symbols as strings, so that an image doesn't depend on
+ * the addresses of the process that dumped it.
+ *
+ * The analyzed bodies of the functions aren't saved: they're analyzed
+ * again on their first call, like the functions of a new lambda
+ * expression.  A procedure without source like the ones returned by
+ * compile, or a continuation, can't be saved.
+ */
+
+#define MAGIC   "LOOTIMG"
+
+enum okind { OATOM, OPAIR, OFUNC, OPRIM, OFLT, ORAT, OFXN, OCHAR, OBOOL,
+             OSTR, OLAMBDA, OENV };
+
+/* Numbers of the shared objects, the other ones start at NFIXED. */
+enum { INULLP, INULL, ITRUE, IFALSE, IUNDEF, NFIXED };
+
+typedef struct table {          /* hash table of pointers */
+        const void **keys;
+        int         *vals;
+        int          n;
+        int          size;
+} table_t;
+
+/* Return the address of the entry of p in the table. */
+static int
+tfind(table_t *tp, const void *p)
+{
+        unsigned long h;
+
+        for (h = (unsigned long)p >> 3; tp->keys[h &= tp->size-1]; h++)
+                if (tp->keys[h] == p)
+                        break;
+        return h;
+}
+
+/* Return the value of p in the table or -1. */
+static int
+tget(table_t *tp, const void *p)
+{
+        int h;
+
+        if (tp->size == 0)
+                return -1;
+        h = tfind(tp, p);
+        return tp->keys[h] ? tp->vals[h] : -1;
+}
+
+/* Add p to the table with the value v. */
+static void
+tput(table_t *tp, const void *p, int v)
+{
+        const void **keys = tp->keys;
+        int *vals = tp->vals, size = tp->size, i, h;
+
+        if (2*(tp->n+1) > tp->size) {
+                tp->size = size ? 2*size : 1024;
+                tp->keys = scalloc(tp->size, sizeof(*tp->keys));
+                tp->vals = smalloc(tp->size*sizeof(*tp->vals));
+                for (i = 0; i < size; i++)
+                        if (keys[i]) {
+                                h = tfind(tp, keys[i]);
+                                tp->keys[h] = keys[i];
+                                tp->vals[h] = vals[i];
+                        }
+                free(keys);
+                free(vals);
+        }
+        h = tfind(tp, p);
+        tp->keys[h] = p;
+        tp->vals[h] = v;
+        tp->n++;
+}
+
+typedef struct dumper {         /* state of the dump of an image */
+        table_t      objs;      /* number of each object */
+        char        *kinds;     /* kind of each object */
+        const void **ptrs;      /* and its address */
+        int          nobjs;
+        int          osize;     /* size of kinds and ptrs */
+        table_t      syms;      /* number of each symbol */
+        symb_t     **strs;      /* symbols by number */
+        int          ssize;     /* size of strs */
+        FILE        *fp;        /* image being written */
+        int          bad;       /* an object can't be saved */
+} dumper_t;
+
+/* Return the number of the object p of the given kind. */
+static int
+visit(dumper_t *dp, int kind, const void *p)
+{
+        int n;
+
+        if (p == NULL)
+                return INULLP;
+        if (p == null)
+                return INULL;
+        if (p == true)
+                return ITRUE;
+        if (p == false)
+                return IFALSE;
+        if (p == undefined)
+                return IUNDEF;
+        if ((n = tget(&dp->objs, p)) >= 0)
+                return n;
+        if (dp->nobjs == dp->osize) {
+                dp->osize = 2*dp->osize+1024;
+                dp->kinds = srealloc(dp->kinds, dp->osize);
+                dp->ptrs = srealloc(dp->ptrs, dp->osize*sizeof(*dp->ptrs));
+        }
+        dp->kinds[dp->nobjs] = kind;
+        dp->ptrs[dp->nobjs] = p;
+        tput(&dp->objs, p, n = NFIXED+dp->nobjs++);
+        return n;
+}
+
+/* Return the number of the symbol s, or -1 for NULL. */
+static int
+symbol(dumper_t *dp, symb_t *s)
+{
+        int n;
+
+        if (s == NULL)
+                return -1;
+        s = strtoatm(s);        /* the labels of primitives aren't atoms */
+        if ((n = tget(&dp->syms, s)) >= 0)
+                return n;
+        if (dp->syms.n == dp->ssize) {
+                dp->ssize = 2*dp->ssize+256;
+                dp->strs = srealloc(dp->strs, dp->ssize*sizeof(*dp->strs));
+        }
+        dp->strs[dp->syms.n] = s;
+        tput(&dp->syms, s, n = dp->syms.n);
+        return n;
+}
+
+/* Return the kind of the expression. */
+static int
+kind(dumper_t *dp, exp_t *ep)
+{
+        switch (type(ep)) {
+        case ATOM:
+                return OATOM;
+        case PAIR:
+                return OPAIR;
+        case PROC:
+                if (ptype(ep) == FUNC && flam(ep)->body != NULL)
+                        return OFUNC;
+                if (ptype(ep) == PRIM && findprim(label(ep)) == ep)
+                        return OPRIM;
+                warnx("can't save the procedure %s in an image", tostr(ep));
+                dp->bad = 1;
+                return OPRIM;
+        case FLOAT:
+                return OFLT;
+        case RAT:
+                return ORAT;
+        case FIXNUM:
+                return OFXN;
+        case CHAR:
+                return OCHAR;
+        case BOOL:
+                return OBOOL;
+        default:
+                return OSTR;
+        }
+}
+
+#define visitexp(dp, ep)        visit(dp, (ep) ? kind(dp, ep) : 0, ep)
+
+/* Write an integer. */
+static inline void
+putint(dumper_t *dp, int n)
+{
+        fwrite(&n, sizeof(n), 1, dp->fp);
+}
+
+/*
+ * Number the objects reachable from the object of index i and write
+ * it.  Its fields are written as numbers.
+ */
+static void
+putobj(dumper_t *dp, int i)
+{
+        const void *p = dp->ptrs[i];
+        exp_t *ep = (exp_t *)p;
+        struct lambda *lp;
+        struct nlist *np;
+        env_t *envp;
+        int j, n;
+
+        switch (dp->kinds[i]) {
+        case OATOM:
+        case OBOOL:
+                putint(dp, symbol(dp, symp(ep)));
+                break;
+        case OPAIR:
+                putint(dp, visitexp(dp, car(ep)));
+                putint(dp, visitexp(dp, cdr(ep)));
+                break;
+        case OFUNC:
+                putint(dp, symbol(dp, label(ep)));
+                putint(dp, visit(dp, OLAMBDA, flam(ep)));
+                putint(dp, visit(dp, OENV, fenv(ep)));
+                break;
+        case OPRIM:             /* written with the kinds, see imgdump */
+                symbol(dp, label(ep));
+                break;
+        case OFLT:
+                fwrite(&flt(ep), sizeof(flt(ep)), 1, dp->fp);
+                break;
+        case ORAT:
+                putint(dp, num(ep));
+                putint(dp, den(ep));
+                break;
+        case OFXN:
+                putint(dp, fixnum(ep));
+                break;
+        case OCHAR:
+                putint(dp, char(ep));
+                break;
+        case OSTR:
+                putint(dp, slen(ep));
+                fwrite(str(ep), 1, slen(ep), dp->fp);
+                break;
+        case OLAMBDA:
+                lp = (struct lambda *)p;
+                putint(dp, visitexp(dp, lp->parp));
+                putint(dp, visitexp(dp, lp->body));
+                putint(dp, visitexp(dp, lp->scope));
+                break;
+        case OENV:
+                envp = (env_t *)p;
+                putint(dp, visit(dp, OENV, eenv(envp)));
+                putint(dp, fframe(envp)->size);
+                for (n = j = 0; j < fframe(envp)->size; j++)
+                        for (np = fframe(envp)->bucket[j]; np; np = np->next)
+                                n++;
+                putint(dp, n);
+                for (j = 0; j < fframe(envp)->size; j++)
+                        for (np = fframe(envp)->bucket[j]; np; np = np->next) {
+                                putint(dp, symbol(dp, np->name));
+                                putint(dp, visitexp(dp, np->defn));
+                        }
+                break;
+        }
+}
+
+/*
+ * Dump the objects reachable from the environment into the image in
+ * path.  The objects are first written in a temporary file, since the
+ * symbols and the kinds of the objects are only known at the end.
+ * The labels of the primitives follow the kinds, so that they're
+ * found before any reference to them is relocated.  Return zero on
+ * success.
+ */
+int
+imgdump(char *path, env_t *envp)
+{
+        dumper_t d;
+        FILE *body;
+        char buf[BUFSIZ];
+        size_t n;
+        int i, root, rc;
+
+        memset(&d, 0, sizeof(d));
+        if ((d.fp = body = tmpfile()) == NULL) {
+                warn("can't create a temporary file");
+                return -1;
+        }
+        root = visit(&d, OENV, envp);
+        for (i = 0; i < d.nobjs; i++)
+                putobj(&d, i);
+        if (d.bad || ferror(body)) {
+                fclose(body);
+                return -1;
+        }
+
+        if ((d.fp = fopen(path, "w")) == NULL) {
+                warn("can't open the image %s", path);
+                fclose(body);
+                return -1;
+        }
+        fwrite(MAGIC, 1, strlen(MAGIC), d.fp);
+        putint(&d, IMGVER);
+        putint(&d, d.syms.n);
+        for (i = 0; i < d.syms.n; i++) {
+                putint(&d, strlen(d.strs[i]));
+                fwrite(d.strs[i], 1, strlen(d.strs[i]), d.fp);
+        }
+        putint(&d, d.nobjs);
+        fwrite(d.kinds, 1, d.nobjs, d.fp);
+        for (i = 0; i < d.nobjs; i++)
+                if (d.kinds[i] == OPRIM)
+                        putint(&d, symbol(&d, label((exp_t *)d.ptrs[i])));
+        putint(&d, root);
+        rewind(body);
+        while ((n = fread(buf, 1, sizeof(buf), body)) > 0)
+                fwrite(buf, 1, n, d.fp);
+        fclose(body);
+        rc = ferror(d.fp);
+        if (fclose(d.fp) != 0 || rc) {
+                warn("can't write the image %s", path);
+                return -1;
+        }
+        free(d.objs.keys);
+        free(d.objs.vals);
+        free(d.syms.keys);
+        free(d.syms.vals);
+        free(d.kinds);
+        free(d.ptrs);
+        free(d.strs);
+        return 0;
+}
+
+typedef struct loader {         /* state of the load of an image */
+        const char  *p;         /* next byte to read */
+        const char  *end;       /* end of the image */
+        symb_t     **syms;      /* symbols by number */
+        int          nsyms;
+        void       **objs;      /* objects by number */
+        int          nobjs;
+        int          bad;       /* is the image corrupted? */
+} loader_t;
+
+/* Copy the next n bytes into s. */
+static void
+get(loader_t *lp, void *s, size_t n)
+{
+        if (lp->bad || (size_t)(lp->end-lp->p) < n) {
+                lp->bad = 1;
+                memset(s, 0, n);
+                return;
+        }
+        memcpy(s, lp->p, n);
+        lp->p += n;
+}
+
+/* Return the next integer. */
+static int
+getint(loader_t *lp)
+{
+        int n;
+
+        get(lp, &n, sizeof(n));
+        return n;
+}
+
+/* Return the object whose number is next, or NULL if it's invalid. */
+static void *
+getobj(loader_t *lp)
+{
+        int n;
+
+        if ((n = getint(lp)) < 0 || n >= lp->nobjs) {
+                lp->bad = 1;
+                return NULL;
+        }
+        return lp->objs[n];
+}
+
+/* Return the symbol whose number is next, or NULL for -1. */
+static symb_t *
+getsym(loader_t *lp)
+{
+        int n;
+
+        if ((n = getint(lp)) == -1)
+                return NULL;
+        if (n < 0 || n >= lp->nsyms) {
+                lp->bad = 1;
+                return NULL;
+        }
+        return lp->syms[n];
+}
+
+/* Allocate an object of the given kind. */
+static void *
+newobj(int kind)
+{
+        exp_t *ep;
+        env_t *envp;
+
+        switch (kind) {
+        case OLAMBDA:
+                return nlam(NULL, NULL, NULL, NULL);
+        case OENV:
+                NEW(envp);
+                return envp;
+        case OFUNC:
+                return nproc(nfunc(NULL, NULL));
+        case OPAIR:
+                return cons(NULL, NULL);
+        default:
+                NEW(ep);
+                type(ep) = kind == OATOM ? ATOM : kind == OFLT ? FLOAT :
+                        kind == ORAT ? RAT : kind == OFXN ? FIXNUM :
+                        kind == OCHAR ? CHAR : kind == OBOOL ? BOOL : STRING;
+                if (kind == ORAT)
+                        NEW(ratp(ep));
+                else if (kind == OSTR)
+                        NEW(strp(ep));
+                return ep;
+        }
+}
+
+/* Fill the fields of the object p. */
+static void *
+getfields(loader_t *lp, int kind, void *p)
+{
+        struct lambda *lamp;
+        exp_t *ep = p;
+        env_t *envp;
+        symb_t *s;
+        int i, n;
+
+        switch (kind) {
+        case OATOM:
+        case OBOOL:
+                if ((symp(ep) = getsym(lp)) == NULL)
+                        lp->bad = 1;
+                break;
+        case OPAIR:
+                car(ep) = getobj(lp);
+                cdr(ep) = getobj(lp);
+                break;
+        case OFUNC:
+                label(ep) = getsym(lp);
+                flam(ep) = getobj(lp);
+                fenv(ep) = getobj(lp);
+                break;
+        case OPRIM:
+                break;
+        case OFLT:
+                get(lp, &flt(ep), sizeof(flt(ep)));
+                break;
+        case ORAT:
+                num(ep) = getint(lp);
+                den(ep) = getint(lp);
+                break;
+        case OFXN:
+                fixnum(ep) = getint(lp);
+                break;
+        case OCHAR:
+                char(ep) = getint(lp);
+                break;
+        case OSTR:
+                if ((n = getint(lp)) < 0 || lp->end-lp->p < n) {
+                        lp->bad = 1;
+                        break;
+                }
+                str(ep) = sstrndup(lp->p, n);
+                slen(ep) = n;
+                lp->p += n;
+                break;
+        case OLAMBDA:
+                lamp = p;
+                lamp->parp = getobj(lp);
+                lamp->body = getobj(lp);
+                lamp->scope = getobj(lp);
+                break;
+        case OENV:
+                envp = p;
+                envp->ep = getobj(lp);
+                if ((n = getint(lp)) <= 0 || lp->bad) {
+                        lp->bad = 1;
+                        break;
+                }
+                envp->fp = newframe(n);
+                for (n = getint(lp), i = 0; i < n && !lp->bad; i++) {
+                        s = getsym(lp);
+                        ep = getobj(lp);
+                        if (s == NULL)
+                                lp->bad = 1;
+                        else
+                                install(s, ep, envp);
+                }
+                break;
+        default:
+                lp->bad = 1;
+                break;
+        }
+        return p;
+}
+
+/*
+ * Load the image in path and return its global environment, or NULL
+ * on failure.  The primitives should be installed.  The image is
+ * mapped in memory: every object is first allocated from the kinds,
+ * and then its fields are relocated to the objects they refer to.
+ */
+env_t *
+imgload(char *path)
+{
+        struct stat st;
+        loader_t l;
+        const char *kinds;
+        env_t *envp;
+        symb_t *s;
+        void *map;
+        int fd, i, n, root;
+
+        if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) != 0 ||
+            (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+            MAP_FAILED) {
+                warn("can't map the image %s", path);
+                if (fd >= 0)
+                        close(fd);
+                return NULL;
+        }
+        close(fd);
+
+        memset(&l, 0, sizeof(l));
+        l.p = map;
+        l.end = l.p+st.st_size;
+        envp = NULL;
+        if ((size_t)st.st_size < strlen(MAGIC) ||
+            memcmp(l.p, MAGIC, strlen(MAGIC)) != 0)
+                goto done;
+        l.p += strlen(MAGIC);
+        if (getint(&l) != IMGVER || (l.nsyms = getint(&l)) < 0)
+                goto done;
+        l.syms = smalloc((l.nsyms+1)*sizeof(*l.syms));
+        for (i = 0; i < l.nsyms && !l.bad; i++) {
+                if ((n = getint(&l)) < 0 || l.end-l.p < n)
+                        goto done;
+                l.syms[i] = natom(l.p, n);
+                l.p += n;
+        }
+
+        if ((n = getint(&l)) < 0 || l.end-l.p < n)
+                goto done;
+        kinds = l.p;
+        l.p += n;
+        l.nobjs = NFIXED+n;
+        l.objs = smalloc(l.nobjs*sizeof(*l.objs));
+        l.objs[INULLP] = NULL;
+        l.objs[INULL] = null;
+        l.objs[ITRUE] = true;
+        l.objs[IFALSE] = false;
+        l.objs[IUNDEF] = undefined;
+        for (i = 0; i < n; i++)
+                if (kinds[i] != OPRIM)
+                        l.objs[NFIXED+i] = newobj(kinds[i]);
+                else if ((s = getsym(&l)) == NULL ||
+                         (l.objs[NFIXED+i] = findprim(s)) == NULL)
+                        goto done;
+        if ((root = getint(&l)) < NFIXED || root >= l.nobjs ||
+            kinds[root-NFIXED] != OENV)
+                goto done;
+        for (i = 0; i < n && !l.bad; i++)
+                l.objs[NFIXED+i] = getfields(&l, kinds[i], l.objs[NFIXED+i]);
+        if (!l.bad && l.p == l.end)
+                envp = l.objs[root];
+done:
+        if (envp == NULL)
+                warnx("%s: bad image", path);
+        free(l.syms);
+        free(l.objs);
+        munmap(map, st.st_size);
+        return envp;
+}
@@ -0,0 +1,13 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+/*
+ * Version of the images.  It should be incremented whenever their
+ * format or the primitives change.
+ */
+#define IMGVER          1
+
+extern int    imgdump(char *, env_t *);
+extern env_t *imgload(char *);
+
+#endif /* !IMAGE_H */
@@ -1,20 +1,63 @@
+#include <getopt.h>
+#include <unistd.h>
+
 #include "extern.h"
 #include "exp.h"
 #include "env.h"
 #include "prim.h"
+#include "cont.h"
+#include "eval.h"
+#include "image.h"
 
 static void initenv(void);
+static void initimage(char *);
+static void usage(void);
 const char *progname;
 
+static struct option longopts[] = {
+        { "dump-image", required_argument, NULL, 'd' },
+        { "image",      required_argument, NULL, 'i' },
+        { "pipeline",   no_argument,       NULL, 'p' },
+        { NULL,         0,                 NULL, 0 }
+};
+
 int
 main(int argc, char *argv[])
 {
+        char base, *dump = NULL, *image = NULL;
+        int c;
+
+        stackbase = &base;      /* the stack copied by call/cc ends here */
         progname = sstrdup(basename(argv[0]));
-        initenv();
-        if (--argc) {
+        while ((c = getopt_long(argc, argv, "ed:i:p", longopts, NULL)) != -1)
+                switch (c) {
+                case 'e':       /* report syntax errors in lambdas at once */
+                        eager = 1;
+                        break;
+                case 'd':       /* dump an image after loading the files */
+                        dump = optarg;
+                        break;
+                case 'i':       /* start from an image */
+                        image = optarg;
+                        break;
+                case 'p':       /* read the files ahead in a thread */
+                        pipeload = 1;
+                        break;
+                default:
+                        usage();
+                }
+        argc -= optind;
+        argv += optind;
+        if (image)
+                initimage(image);
+        else
+                initenv();
+        if (argc || dump) {
                 while (argc--)
-                        if (load(*++argv, NINTER))
+                        if (load(*argv++, NINTER))
                                 exit(EXIT_FAILURE);
+                if (dump && imgdump(dump, globenv))
+                        exit(EXIT_FAILURE);
         } else {
                 load(NULL, INTER);
                 putchar('\n');
@@ -49,4 +92,26 @@ initenv(void)
         if (!ret)
                 snprintf(buf, BUFSIZ, "%s", LIBNAM);
         load(buf, NINTER);
+        instlib(globenv);
+}
+
+/* Initialize the global environment from an image. */
+static void
+initimage(char *path)
+{
+        initkeys();
+        globenv = newenv();
+        instcst(globenv);
+        instprim(globenv);      /* the primitives referred to by the image */
+        if ((globenv = imgload(path)) == NULL)
+                exit(EXIT_FAILURE);
+        instlib(globenv);
+}
+
+static void
+usage(void)
+{
+        fprintf(stderr, "usage: %s [-ep] [--image file] [--dump-image file] "
+                "[file ...]\n", progname);
+        exit(EXIT_FAILURE);
 }
@@ -7,6 +7,8 @@
 #include "read.h"
 #include "env.h"
 #include "eval.h"
+#include "cont.h"
+#include "fasl.h"
 
 static exp_t *prim_add(exp_t *);
 static exp_t *prim_sub(exp_t *);
@@ -27,6 +29,12 @@ static exp_t *prim_car(exp_t *);
 static exp_t *prim_cdr(exp_t *);
 static exp_t *prim_apply(exp_t *);
 static exp_t *prim_load(exp_t *);
+static exp_t *prim_eval(exp_t *);
+static exp_t *prim_compile(exp_t *);
+static exp_t *prim_callcc(exp_t *);
+static exp_t *prim_callec(exp_t *);
+static exp_t *prim_values(exp_t *);
+static exp_t *prim_callvals(exp_t *);
 static exp_t *prim_sin(exp_t *);
 static exp_t *prim_cos(exp_t *);
 static exp_t *prim_tan(exp_t *);
@@ -35,6 +43,7 @@ static exp_t *prim_log(exp_t *);
 static exp_t *prim_exp(exp_t *);
 static exp_t *prim_pow(exp_t *);
 static exp_t *prim_read(void);
+static exp_t *prim_readpar(exp_t *);
 static exp_t *prim_write(exp_t *);
 
 /* List of primitive procedures */
@@ -73,11 +82,34 @@ static struct {
         /* I/O */
         {"write", prim_write},
         {"read", prim_read},
+        {"read-file-parallel", prim_readpar},
         /* misc */
         {"apply", prim_apply},
         {"load", prim_load},
+        {"eval", prim_eval},
+        {"compile", prim_compile},
+        /* control */
+        {"call-with-current-continuation", prim_callcc},
+        {"call/cc", prim_callcc},
+        {"call-with-escape-continuation", prim_callec},
+        {"call/ec", prim_callec},
+        {"values", prim_values},
+        {"call-with-values", prim_callvals},
 };
 
+#define X(k, s)	s
+static char *inames[] = { INTRINSICS };
+#undef	X
+
+exp_t *intrinsic[NINTRINSICS];  /* original value of the intrinsics */
+static exp_t *prims[NELEMS(plst)]; /* the primitive procedures */
+
+#define X(k, s)	s
+static char *lnames[] = { LIBPROCS };
+#undef	X
+
+exp_t *libproc[NLIBPROCS];      /* value of the procedures of the library */
+
 /* Install the primitive procedures in the environment */
 void
 instprim(env_t *envp)
@@ -85,22 +117,70 @@ instprim(env_t *envp)
         int i;
 
         for (i = 0; i < NELEMS(plst); i++)
-                install(plst[i].n, nproc(nprim(plst[i].n, plst[i].pp)), envp);
+                install(plst[i].n, prims[i] = nproc(nprim(plst[i].n,
+                                                          plst[i].pp)), envp);
+        for (i = 0; i < NINTRINSICS; i++)
+                intrinsic[i] = lookup(strtoatm(inames[i]), envp)->defn;
+}
+
+/* Return the primitive procedure whose label is s or NULL. */
+exp_t *
+findprim(const char *s)
+{
+        int i;
+
+        for (i = 0; i < NELEMS(plst); i++)
+                if (strcmp(plst[i].n, s) == 0)
+                        return prims[i];
+        return NULL;
+}
+
+/*
+ * Remember the procedures of the library known to the evaluator.  It
+ * should be called once the library is loaded.
+ */
+void
+instlib(env_t *envp)
+{
+        struct nlist *np;
+        int i;
+
+        for (i = 0; i < NLIBPROCS; i++)
+                libproc[i] = (np = lookup(strtoatm(lnames[i]), envp)) ?
+                        np->defn : NULL;
 }
 
-/* Evaluate all the expressions in the file */
+int pipeload;                   /* read the files in a separate thread */
+
+/*
+ * Evaluate all the expressions in the file.  The forms of a file, or
+ * their evaluation procedures, are taken from its compiled file if
+ * it's up to date (see fasl.c), and otherwise they're read and compiled
+ * for the next loads, ahead by a reader thread if pipeload is set (see
+ * rstart).
+ */
 int
-load(char *path, mode_t isinter)
+load(char *path, ldmode_t isinter)
 {
         stream *sp = instream;  /* save the current input stream */
-        int	rc = 0;
+        fasl_t *cp = NULL;      /* forms of the compiled file */
+        fasl_t *fp = NULL;      /* or forms to compile */
+        cont_t *cc = ccstack;   /* continuations active around the load */
+        int	rc = 0, i = 0;
         exp_t  *ep;
+        evproc_t *epp;
+        long	pos;
 
         if (path != NULL) {
                 if ((instream = sopen(path)) == NULL) {
                         rc = 1;
                         goto cleanup;
                 }
+                if ((cp = faslload(path)) == NULL) {
+                        fp = faslnew(path);
+                        if (pipeload)
+                                instream = rstart(instream);
+                }
         } else
                 instream = nstream("stdin", stdin);
 
@@ -110,23 +190,54 @@ read:
                         printf("%s", INPR);
                         fflush(stdout);
                 }
-                ep = eval(read(), globenv);
+                if (cp == NULL) {
+                        ep = read();
+                        if (fp)
+                                faslput(fp, ep, topexplin, topexpcol);
+                        epp = toproc(ep);
+                        if (fp)
+                                faslproc(fp, epp);
+                } else if (i < cp->nforms) {
+                        topexplin = cp->lines[i];
+                        topexpcol = cp->cols[i];
+                        epp = cp->procs[i] ? cp->procs[i] :
+                                toproc(cp->forms[i]);
+                        i++;
+                } else
+                        RAISE(eof_error, "end of file");
+                pos = stell(instream);
+                ep = evalproc(epp, globenv);
+                if (fp && stell(instream) != pos)
+                        fp->ok = 0;     /* the file is read by itself */
                 if (isinter && ep != NULL) {
-                        printf("%s%s\n", OUTPR, tostr(ep));
+                        printf("%s", OUTPR);
+                        fputexp(ep, stdout);
+                        putchar('\n');
                         fflush(stdout);
                 }
-        WARN(read_error);
+        WARN(read_error)
+                if (fp)
+                        fp->ok = 0;
         WARN(syntax_error);
         WARN(eval_error);
         CATCH(eof_error)
+                if (fp)
+                        faslsave(fp, path);
                 goto cleanup;
         ENDTRY;
 
+        ccunwind(cc);
         xfreeall();
         goto read;
 cleanup:
         xfreeall();
-        if (instream)
+        if (cp)
+                faslfree(cp);
+        if (fp)
+                faslfree(fp);
+        if (instream && instream->pipe)
+                rstop(instream);
+        else if (instream)
                 sclose(instream);
         instream = sp;
 
@@ -412,6 +523,30 @@ prim_load(exp_t *args)
         return NULL;
 }
 
+/* Call the procedure with the current continuation */
+static exp_t *
+prim_callcc(exp_t *args)
+{
+        chkargs("call/cc", args, 1);
+        if (!isproc(car(args)))
+                everr("call/cc: should be a procedure", car(args));
+        return callcc(car(args), 1);
+}
+
+/*
+ * Call the procedure with a continuation that can only be used to
+ * escape from it.  It's cheaper than call/cc since the stack isn't
+ * copied.
+ */
+static exp_t *
+prim_callec(exp_t *args)
+{
+        chkargs("call/ec", args, 1);
+        if (!isproc(car(args)))
+                everr("call/ec: should be a procedure", car(args));
+        return callcc(car(args), 0);
+}
+
 /* Return the sine of the expression */
 static exp_t *
 prim_sin(exp_t *args)
@@ -505,13 +640,57 @@ static exp_t *
 prim_write(exp_t *args)
 {
         chkargs("write", args, 1);
-        printf("%s", tostr(car(args)));
+        fputexp(car(args), stdout);
         return NULL;
 }
 
+/* Evaluate an expression in the global environment. */
+static exp_t *
+prim_eval(exp_t *args)
+{
+        chkargs("eval", args, 1);
+        return evcached(car(args), globenv);
+}
+
+/*
+ * Return a procedure without arguments that evaluates the expression
+ * in the global environment.
+ */
+static exp_t *
+prim_compile(exp_t *args)
+{
+        chkargs("compile", args, 1);
+        return compile(car(args), globenv);
+}
+
+/* Return the arguments as multiple values. */
+static exp_t *
+prim_values(exp_t *args)
+{
+        return values(args);
+}
+
+/* Call the consumer with the values returned by the producer. */
+static exp_t *
+prim_callvals(exp_t *args)
+{
+        chkargs("call-with-values", args, 2);
+        return callvals(car(args), cadr(args));
+}
+
 /* Read an expression from the standard input. */
 static exp_t *
 prim_read(void)
 {
         return read();
 }
+
+/* Return the list of the expressions of a file, read in parallel. */
+static exp_t *
+prim_readpar(exp_t *args)
+{
+        chkargs("read-file-parallel", args, 1);
+        if (!isstr(car(args)))
+                everr("read-file-parallel: should be a string", car(args));
+        return readpar(str(car(args)));
+}
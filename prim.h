@@ -30,9 +30,48 @@
                 return nfloat(proc(VALUE(car(args))));  \
         } while (0)
 
-typedef enum mode { NINTER, INTER } mode_t;
+/* Primitives known to the evaluator (see instprim). */
+#define INTRINSICS                              \
+                X(ADD, "+"),                    \
+                X(SUB, "-"),                    \
+                X(PROD, "*"),                   \
+                X(NUMEQ, "="),                  \
+                X(LT, "<"),                     \
+                X(GT, ">"),                     \
+                X(CAR, "car"),                  \
+                X(CDR, "cdr"),                  \
+                X(CONS, "cons"),                \
+                X(EQ, "eq?"),                   \
+                X(VALUES, "values"),            \
+                X(CALLVALS, "call-with-values")
 
-extern int load(char *, mode_t);
+#define X(k, s) P##k
+enum pindex { INTRINSICS, NINTRINSICS }; /* Index of primitives in intrinsic. */
+#undef  X
+
+extern exp_t *intrinsic[];
+
+/* Procedures of the library known to the evaluator (see instlib). */
+#define LIBPROCS                                \
+                X(MAP, "map"),                  \
+                X(FOLDL, "foldl"),              \
+                X(FOLDR, "foldr"),              \
+                X(REVERSE, "reverse"),          \
+                X(APPEND, "append")
+
+#define X(k, s) L##k
+enum lindex { LIBPROCS, NLIBPROCS }; /* Index of procedures in libproc. */
+#undef  X
+
+extern exp_t *libproc[];
+
+typedef enum mode { NINTER, INTER } ldmode_t;
+
+extern int pipeload;
+
+extern int load(char *, ldmode_t);
 extern void instprim(struct env *);
+extern void instlib(struct env *);
+extern exp_t *findprim(const char *);
 
 #endif /* !PRIM_H */
@@ -1,354 +1,675 @@
+#include <pthread.h>
+
 #include "extern.h"
 #include "exp.h"
 #include "read.h"
+#include "scan.h"
 #include "type.h"
 
 const excpt_t read_error = { "read" };
 
-static exp_t *read_atm(char);
+static exp_t *read_atm(char *);
 static exp_t *read_char(void);
 static exp_t *read_sharp(void);
-static exp_t *read_rparen(void);
-static exp_t *read_dot(void);
 static exp_t *read_str(void);
-static exp_t *read_pair(unsigned);
-static exp_t *read_quote(unsigned);
-static exp_t *read_qquote(unsigned);
-static exp_t *read_comma(unsigned);
-
-/* Syntax table. */
-static exp_t *(*stab[128])() = {
-        /* 0  NUL */ NULL,
-        /* 1  SOH */ NULL,
-        /* 2  STX */ NULL,
-        /* 3  ETX */ NULL,
-        /* 4  EOT */ NULL,
-        /* 5  ENQ */ NULL,
-        /* 6  ACK */ NULL,
-        /* 7  BEL */ NULL,
-        /* 8  BS  */ NULL,
-        /* 9  HT  */ NULL,
-        /* 10 NL  */ NULL,
-        /* 11 VT  */ NULL,
-        /* 12 NP  */ NULL,
-        /* 13 CR  */ NULL,
-        /* 14 SO  */ NULL,
-        /* 15 SI  */ NULL,
-        /* 16 DLE */ NULL,
-        /* 17 DC1 */ NULL,
-        /* 18 DC2 */ NULL,
-        /* 19 DC3 */ NULL,
-        /* 20 DC4 */ NULL,
-        /* 21 NAK */ NULL,
-        /* 22 SYN */ NULL,
-        /* 23 ETB */ NULL,
-        /* 24 CAN */ NULL,
-        /* 25 EM  */ NULL,
-        /* 26 SUB */ NULL,
-        /* 27 ESC */ NULL,
-        /* 28 FS  */ NULL,
-        /* 29 GS  */ NULL,
-        /* 30 RS  */ NULL,
-        /* 31 US  */ NULL,
-        /* 32 SP  */ NULL,
-        /* 33 !   */ NULL,
-        /* 34 "   */ read_str,
-        /* 35 #   */ read_sharp,
-        /* 36 $   */ NULL,
-        /* 37 %   */ NULL,
-        /* 38 &   */ NULL,
-        /* 39 '   */ read_quote,
-        /* 40 (   */ read_pair,
-        /* 41 )   */ read_rparen,
-        /* 42 *   */ NULL,
-        /* 43 +   */ NULL,
-        /* 44 ,   */ read_comma,
-        /* 45 -   */ NULL,
-        /* 46 .   */ read_dot,
-        /* 47 /   */ NULL,
-        /* 48 0   */ NULL,
-        /* 49 1   */ NULL,
-        /* 50 2   */ NULL,
-        /* 51 3   */ NULL,
-        /* 52 4   */ NULL,
-        /* 53 5   */ NULL,
-        /* 54 6   */ NULL,
-        /* 55 7   */ NULL,
-        /* 56 8   */ NULL,
-        /* 57 9   */ NULL,
-        /* 58 :   */ NULL,
-        /* 59 ;   */ NULL,
-        /* 60 <   */ NULL,
-        /* 61 =   */ NULL,
-        /* 62 >   */ NULL,
-        /* 63 ?   */ NULL,
-        /* 64 @   */ NULL,
-        /* 65 A   */ NULL,
-        /* 66 B   */ NULL,
-        /* 67 C   */ NULL,
-        /* 68 D   */ NULL,
-        /* 69 E   */ NULL,
-        /* 70 F   */ NULL,
-        /* 71 G   */ NULL,
-        /* 72 H   */ NULL,
-        /* 73 I   */ NULL,
-        /* 74 J   */ NULL,
-        /* 75 K   */ NULL,
-        /* 76 L   */ NULL,
-        /* 77 M   */ NULL,
-        /* 78 N   */ NULL,
-        /* 79 O   */ NULL,
-        /* 80 P   */ NULL,
-        /* 81 Q   */ NULL,
-        /* 82 R   */ NULL,
-        /* 83 S   */ NULL,
-        /* 84 T   */ NULL,
-        /* 85 U   */ NULL,
-        /* 86 V   */ NULL,
-        /* 87 W   */ NULL,
-        /* 88 X   */ NULL,
-        /* 89 Y   */ NULL,
-        /* 90 Z   */ NULL,
-        /* 91 [   */ NULL,
-        /* 92 \   */ NULL,
-        /* 93 ]   */ NULL,
-        /* 94 ^   */ NULL,
-        /* 95 _   */ NULL,
-        /* 96 `   */ read_qquote
-};
 
 /*
  * Return the next character from the input stream skipping comments
- * and white-spaces.
+ * and white-spaces, or EOF at its end.
  */
-static char
+static int
 getch(void)
 {
-        register char c;
+        register stream *sp = instream;
+        char *p;
 
         for (;;) {
-                while (isspace(c = sgetchar()))
-                        ;
-                if (c != ';')
-                        break;
-                while ((c = sgetchar()) != '\n') /* comment */
-                        ;
+                if ((sp->cur = skipspace(sp->cur, sp->end)) == sp->end) {
+                        if (!sfill(sp))
+                                return EOF;
+                        continue;
+                }
+                if (*sp->cur != ';')
+                        return (unsigned char)*sp->cur++;
+                p = memchr(sp->cur, '\n', sp->end - sp->cur); /* comment */
+                sp->cur = (p ? p+1 : sp->end);
         }
-        return c;
 }
 
 /* Position of the current top-level expression. */
-unsigned topexplin;
-unsigned topexpcol;
+TLS unsigned topexplin;
+TLS unsigned topexpcol;
 
 #define eoferr() 		RAISE(read_error, "unexpected end of file")
 #define doterr(line, col)	raise(&read_error, instream->name, line, col, \
                                       "Illegal use of .")
 
 /*
- * Read an expression from the input stream.
+ * The lists and abbreviations being read are kept on an explicit
+ * stack instead of the C one so that the reader runs in constant
+ * stack space whatever the length or the depth of the lists.
  */
-static inline exp_t *
-read0(unsigned level)
+enum { PLIST, PDOT, PEND, PABBR };
+
+static TLS struct pframe {
+        int       kind;         /* list, after a dot, after its cdr or abbrev */
+        exp_t    *kw;           /* keyword of an abbreviation */
+        exp_t    *head;         /* elements of the list read so far */
+        exp_t    *tail;
+        unsigned  line;         /* position of the dot */
+        unsigned  col;
+} *pstack;
+static TLS int psize;           /* size of the parse stack */
+static TLS int ptop;            /* and number of frames in use */
+
+/* Push a frame on the parse stack. */
+static inline struct pframe *
+push(int kind)
 {
-        exp_t *(*read_syn)();
-        unsigned char c;
+        struct pframe *fp;
 
-        c = getch();
-        if (level == 0) {
-                topexplin = instream->line;
-                topexpcol = instream->col;
+        if (ptop == psize) {
+                psize = psize ? 2*psize : 64;
+                pstack = srealloc(pstack, psize*sizeof(*pstack));
         }
-        return (c < NELEMS(stab) && (read_syn = stab[c]) != NULL ?
-                read_syn(level) : read_atm(c));
+        fp = &pstack[ptop++];
+        fp->kind = kind;
+        fp->head = fp->tail = NULL;
+        return fp;
 }
 
-/* External interface to read. Use read0 internally. */
-exp_t *
-read(void)
+/* Push an abbreviation whose keyword is ki on the parse stack. */
+static inline void
+abbrev(enum kindex ki)
 {
-        return read0(0);
+        push(PABBR)->kw = keywords[ki];
 }
 
-/* Read a pair expression from the input stream. */
+/*
+ * Read an expression from the input stream.  Return NULL if the end
+ * of the stream is reached before the start of the expression.
+ */
 static exp_t *
-read_pair(unsigned level)
+read0(void)
 {
-        exp_t *car, *cdr;
-        char c;
+        struct pframe *fp;
+        exp_t *ep;
+        unsigned line, col;
+        int c;
 
-        TRY
-                if ((c = getch()) == ')')
-                        RETURN(null);
-                sungetch(c);
-                car = read0(level+1);
-                cdr = NULL;
-                if ((c = getch()) == '.') {
-                        unsigned dotline, dotcol;
-                        dotline = instream->line;
-                        dotcol  = instream->col;
-                        if (issep(c = sgetchar())) {
-                                cdr = read0(level+1);
-                                if (getch() != ')')
-                                        doterr(dotline, dotcol);
-                        } else {
+        ptop = 0;
+        sdrop(instream);
+        for (;;) {
+                if ((c = getch()) == EOF) {
+                        if (ptop == 0)
+                                return NULL;
+                        if (pstack[ptop-1].kind == PABBR)
+                                eoferr();
+                        RAISE1(read_error, "too many open parenthesis");
+                }
+                if (ptop == 0) {
+                        topexplin = sline(instream);
+                        topexpcol = scol(instream);
+                }
+                fp = ptop ? &pstack[ptop-1] : NULL;
+                switch (c) {
+                case '(':
+                        push(PLIST);
+                        continue;
+                case ')':
+                        if (fp == NULL || fp->kind == PABBR)
+                                RAISE(read_error, "unexpected )");
+                        if (fp->kind == PDOT)
+                                doterr(fp->line, fp->col);
+                        ep = fp->head ? fp->head : null;
+                        ptop--;
+                        break;
+                case '\'':
+                        abbrev(QUOTE);
+                        continue;
+                case '`':
+                        abbrev(QQUOTE);
+                        continue;
+                case ',':
+                        if ((c = sgetchar()) == '@')
+                                abbrev(SPLICE);
+                        else {
                                 sungetch(c);
-                                c = '.';
+                                abbrev(UNQUOTE);
+                        }
+                        continue;
+                case '.':
+                        line = sline(instream);
+                        col  = scol(instream);
+                        if ((c = sgetchar()) != EOF && !issep(c)) {
+                                sungetch(c);
+                                ep = read_atm(instream->cur-1);
+                                break;
                         }
-                }
-                if (!cdr) {
                         sungetch(c);
-                        cdr = read_pair(level);
+                        if (fp == NULL || fp->kind != PLIST || !fp->head)
+                                doterr(line, col);
+                        fp->kind = PDOT;
+                        fp->line = line;
+                        fp->col  = col;
+                        continue;
+                case '"':
+                        ep = read_str();
+                        break;
+                case '#':
+                        ep = read_sharp();
+                        break;
+                default:
+                        ep = read_atm(instream->cur-1);
+                        break;
                 }
-        CATCH(eof_error)
-                RAISE1(read_error, "too many open parenthesis");
-        ENDTRY;
 
-        return cons(car, cdr);
+                /* Add the expression to the enclosing ones. */
+                while (ptop > 0 && (fp = &pstack[ptop-1])->kind == PABBR) {
+                        ep = cons(fp->kw, cons(ep, null));
+                        ptop--;
+                }
+                if (ptop == 0)
+                        return ep;
+                switch (fp->kind) {
+                case PLIST:
+                        ep = cons(ep, null);
+                        if (fp->head == NULL)
+                                fp->head = ep;
+                        else
+                                cdr(fp->tail) = ep;
+                        fp->tail = ep;
+                        break;
+                case PDOT:
+                        cdr(fp->tail) = ep;
+                        fp->kind = PEND;
+                        break;
+                default:
+                        doterr(fp->line, fp->col);
+                }
+        }
 }
 
-/* Parse a non-pair expression */
-static exp_t *
-parse_atm(char *s, int len)
+static exp_t *rget(stream *);
+
+/* External interface to read. Use read0 internally. */
+exp_t *
+read(void)
 {
         exp_t *ep;
-        char *p, *endp;
-        int n, d;
-
-        p = sstrndup(s, len);
-        if (isfloatstr(p, len))
-                ep = nfloat(atof(p));
-        else if (isratstr(p, len)) {
-                n = strtol(p, &endp, 10);
-                if (*endp == '/') {
-                        d = strtol(++endp, NULL, 10);
-                        ep = nrat(n, d);
-                } else
-                        ep = nfixnum(n);
-        } else
-                ep = atom(p);
-        free(p);
+
+        if (instream->pipe != NULL)
+                return rget(instream);
+        if ((ep = read0()) == NULL)
+                RAISE(eof_error, "end of file");
         return ep;
 }
 
-/* Read an atom from the input stream. */
-static exp_t *
-read_atm(char c)
+/*
+ * Reading of a file by several threads.
+ *
+ * The file is cut in chunks at white-spaces between top-level forms,
+ * each chunk is read by a thread into its own list and the lists are
+ * put together in the order of the file.  The expressions are built
+ * with malloc which has an arena per thread, and the symbols table is
+ * shared under a lock (see natom).
+ */
+#define MAXTHREADS      16              /* maximum number of threads */
+#define MINCHUNK        (1<<16)         /* minimum size of a chunk */
+
+struct chunk {                  /* chunk of a file read by a thread */
+        stream   *sp;           /* characters of the chunk */
+        char     *start;        /* and their position in the file */
+        unsigned  line;
+        unsigned  col;
+        exp_t    *head;         /* forms read */
+        exp_t    *tail;
+        int       failed;       /* error while reading */
+        char      msg[MAXLINE];
+        unsigned  errlin;
+        unsigned  errcol;
+};
+
+/*
+ * Cut the characters from p to end in at most n chunks starting at
+ * the white-spaces that follow a top-level form.  Return the number
+ * of chunks.
+ */
+static int
+cutforms(char *p, char *end, struct chunk *cp, int n)
 {
-        buf_t *bp;
+        char *bol, *target;
+        size_t size;
+        int depth, quoted, k;
+        unsigned line;
+
+        size = end - p;
+        cp[0].start = p;
+        cp[0].line = 1;
+        cp[0].col = 0;
+        target = p + size/n;
+        bol = p;
+        line = 1;
+        depth = quoted = 0;
+        for (k = 1; p < end && k < n; ) {
+                switch (*p) {
+                case ' ': case '\t': case '\n': case '\v': case '\f':
+                case '\r':
+                        if (depth == 0 && !quoted && p >= target) {
+                                cp[k].start = p;
+                                cp[k].line = line;
+                                cp[k].col = p - bol;
+                                target = cp[0].start + (++k)*(size/n);
+                        }
+                        if (*p++ == '\n') {
+                                line++;
+                                bol = p;
+                        }
+                        break;
+                case ';':
+                        if ((p = memchr(p, '\n', end-p)) == NULL)
+                                p = end;
+                        break;
+                case '"':
+                        for (p++; p < end && *p != '"'; p++)
+                                if (*p == '\n') {
+                                        line++;
+                                        bol = p+1;
+                                }
+                        p++;
+                        quoted = 0;
+                        break;
+                case '(':
+                        depth++;
+                        quoted = 0;
+                        p++;
+                        break;
+                case ')':
+                        if (depth > 0)
+                                depth--;
+                        p++;
+                        break;
+                case '\'': case '`': case ',':
+                        quoted = 1;
+                        p++;
+                        break;
+                case '#':
+                        p += (p+1 < end && p[1] == '\\' ? 3 : 1);
+                        quoted = 0;
+                        break;
+                default:
+                        quoted = 0;
+                        p++;
+                        break;
+                }
+        }
+        return k;
+}
+
+/* Read the forms of a chunk. */
+static void *
+readchunk(void *arg)
+{
+        struct chunk *cp = arg;
         exp_t *ep;
 
-        bp = binit();
+        instream = cp->sp;
+        cp->head = cp->tail = NULL;
+        cp->failed = 0;
         TRY
-                do
-                        bputc(tolower(c), bp);
-                while (!issep(c = sgetchar()));
-        CATCH(eof_error);
+                while ((ep = read0()) != NULL) {
+                        ep = cons(ep, null);
+                        if (cp->head == NULL)
+                                cp->head = ep;
+                        else
+                                cdr(cp->tail) = ep;
+                        cp->tail = ep;
+                }
+        CATCH(read_error)
+                cp->failed = 1;
+                snprintf(cp->msg, sizeof(cp->msg), "%s", exfram.msg);
+                cp->errlin = exfram.line;
+                cp->errcol = exfram.col;
         ENDTRY;
-        if (!feof(instream->fp))
-                sungetch(c);
+        free(pstack);
+        pstack = NULL;
+        psize = 0;
+        return NULL;
+}
 
-        ep = parse_atm(bp->buf, bp->len);
-        bfree(bp);
-        return ep;
+/*
+ * Return the list of the forms of the file at path.  A large file is
+ * read by several threads.
+ */
+exp_t *
+readpar(char *path)
+{
+        struct chunk chunks[MAXTHREADS];
+        pthread_t tids[MAXTHREADS];
+        stream *sp, *saved;
+        exp_t *res, *last;
+        char *end;
+        int i, n, ncpu;
+
+        if ((sp = sopen(path)) == NULL)
+                RAISE(read_error, "can't open file %s", path);
+        n = 1;
+        if (sp->mapped) {
+                if ((ncpu = ncpus()) > MAXTHREADS)
+                        ncpu = MAXTHREADS;
+                if (ncpu > 1 && (sp->end - sp->buf)/ncpu >= MINCHUNK)
+                        n = cutforms(sp->buf, sp->end, chunks, ncpu);
+        }
+
+        saved = instream;
+        if (n == 1) {
+                chunks[0].sp = sp;
+                readchunk(&chunks[0]);
+        } else {
+                for (i = 0; i < n; i++) {
+                        end = (i+1 < n ? chunks[i+1].start : sp->end);
+                        chunks[i].sp = sslice(sp, chunks[i].start, end,
+                                              chunks[i].line, chunks[i].col);
+                }
+                for (i = 1; i < n; i++)
+                        if (pthread_create(&tids[i], NULL, readchunk,
+                                           &chunks[i]) != 0)
+                                err_sys("pthread_create");
+                readchunk(&chunks[0]);
+                for (i = 1; i < n; i++)
+                        pthread_join(tids[i], NULL);
+        }
+        instream = saved;
+
+        for (i = 0; i < n; i++)
+                if (chunks[i].sp != sp)
+                        sclose(chunks[i].sp);
+        sclose(sp);
+
+        res = last = NULL;
+        for (i = 0; i < n; i++) {
+                if (chunks[i].failed)
+                        raise(&read_error, basename(path), chunks[i].errlin,
+                              chunks[i].errcol, "%s", chunks[i].msg);
+                if (chunks[i].head == NULL)
+                        continue;
+                if (res == NULL)
+                        res = chunks[i].head;
+                else
+                        cdr(last) = chunks[i].head;
+                last = chunks[i].tail;
+        }
+        return (res ? res : null);
 }
 
-/* Read a string from the input stream.*/
+/*
+ * Reading ahead in a separate thread.
+ *
+ * The forms of a stream are read by a thread into a bounded queue
+ * while the main thread evaluates them.  The main thread receives
+ * them through a stream without characters whose position is the end
+ * of the last form received, so that the errors are located as if it
+ * had read them itself, and a form calling read gets the next form of
+ * the queue.  Nothing evaluated can change how the next forms are
+ * parsed, so the reader never has to wait for the evaluator.
+ */
+#define QSIZE   64              /* number of forms read ahead */
+
+enum { QFORM, QEOF, QERR };
+
+struct qitem {                  /* form or error read */
+        int       kind;
+        exp_t    *ep;
+        unsigned  line;         /* position of the form or of the error */
+        unsigned  col;
+        unsigned  eline;        /* position of the end of the form */
+        unsigned  ecol;
+        long      off;
+        char      msg[MAXLINE]; /* message of the error */
+};
+
+struct rdpipe {
+        stream          *sp;            /* stream read by the thread */
+        pthread_t        tid;
+        pthread_mutex_t  lock;
+        pthread_cond_t   nonempty;
+        pthread_cond_t   nonfull;
+        struct qitem     q[QSIZE];
+        int              head;          /* first item of the queue */
+        int              n;             /* and number of items */
+        int              stop;          /* should the thread stop? */
+};
+
+/* Put an item in the queue.  Return 0 if the thread should stop. */
+static int
+qput(struct rdpipe *pp, struct qitem *ip)
+{
+        int ok;
+
+        pthread_mutex_lock(&pp->lock);
+        while (pp->n == QSIZE && !pp->stop)
+                pthread_cond_wait(&pp->nonfull, &pp->lock);
+        if ((ok = !pp->stop)) {
+                pp->q[(pp->head+pp->n) % QSIZE] = *ip;
+                pp->n++;
+                pthread_cond_signal(&pp->nonempty);
+        }
+        pthread_mutex_unlock(&pp->lock);
+        return ok;
+}
+
+/* Read the forms of the stream of a pipe until its end. */
+static void *
+readahead(void *arg)
+{
+        struct rdpipe *pp = arg;
+        struct qitem it;
+
+        instream = pp->sp;
+        do {
+                TRY
+                        it.kind = ((it.ep = read0()) == NULL ? QEOF : QFORM);
+                        it.line = topexplin;
+                        it.col  = topexpcol;
+                CATCH(read_error)
+                        it.kind = QERR;
+                        it.line = exfram.line;
+                        it.col  = exfram.col;
+                        snprintf(it.msg, sizeof(it.msg), "%s", exfram.msg);
+                ENDTRY;
+                it.eline = sline(instream);
+                it.ecol  = scol(instream);
+                it.off   = stell(instream);
+        } while (qput(pp, &it) && it.kind != QEOF);
+        free(pstack);
+        pstack = NULL;
+        psize = 0;
+        return NULL;
+}
+
+/* Return the next form read by the thread feeding the stream sp. */
 static exp_t *
-read_str(void)
+rget(stream *sp)
 {
-        register char c;
-        unsigned line, col;
-        buf_t *bp;
+        struct rdpipe *pp = sp->pipe;
+        struct qitem *ip;
+        char msg[MAXLINE];
         exp_t *ep;
+        int kind;
+
+        pthread_mutex_lock(&pp->lock);
+        while (pp->n == 0)
+                pthread_cond_wait(&pp->nonempty, &pp->lock);
+        ip = &pp->q[pp->head];
+        sp->line = ip->eline;
+        sp->col  = ip->ecol;
+        sp->off  = ip->off;
+        topexplin = ip->line;
+        topexpcol = ip->col;
+        kind = ip->kind;
+        ep = ip->ep;
+        if (kind == QERR)
+                snprintf(msg, sizeof(msg), "%s", ip->msg);
+        if (kind != QEOF) {     /* the end is left for the next calls */
+                pp->head = (pp->head+1) % QSIZE;
+                pp->n--;
+                pthread_cond_signal(&pp->nonfull);
+        }
+        pthread_mutex_unlock(&pp->lock);
 
-        bp   = binit();
-        line = instream->line;
-        col  = instream->col;
-        TRY
-                while ((c = sgetchar()) != '"')
-                        bputc(c, bp);
-        CATCH(eof_error)
-                raise(&read_error,instream->name,line,col,"unmatched quote");
-        ENDTRY;
-
-        ep = nstr(bp->buf, bp->len);
-        bfree(bp);
+        if (kind == QEOF)
+                RAISE(eof_error, "end of file");
+        else if (kind == QERR)
+                raise(&read_error, sp->name, topexplin, topexpcol, "%s", msg);
         return ep;
 }
 
-static inline exp_t *
-enclose(enum kindex ki, unsigned level)
+/*
+ * Start a thread reading the forms of the stream sp ahead and return
+ * the stream from which they are received.
+ */
+stream *
+rstart(stream *sp)
 {
-        exp_t *ep;
+        struct rdpipe *pp;
+        stream *ps;
+
+        NEW(pp);
+        pp->sp = sp;
+        pp->head = pp->n = pp->stop = 0;
+        pthread_mutex_init(&pp->lock, NULL);
+        pthread_cond_init(&pp->nonempty, NULL);
+        pthread_cond_init(&pp->nonfull, NULL);
+
+        NEW(ps);
+        *ps = *sp;
+        ps->name = sstrdup(sp->name);
+        ps->pipe = pp;
+        ps->fp = NULL;
+        ps->buf = ps->cur = ps->end = ps->lpos = NULL;
+        ps->size = 0;
+        ps->mapped = 1;
+        if (pthread_create(&pp->tid, NULL, readahead, pp) != 0)
+                err_sys("pthread_create");
+        return ps;
+}
 
-        TRY
-                ep = read0(level+1);
-        CATCH(eof_error)
-                eoferr();
-        ENDTRY;
-        return cons(keywords[ki], cons(ep, null));
+/* Stop the thread feeding the stream ps and close both streams. */
+void
+rstop(stream *ps)
+{
+        struct rdpipe *pp = ps->pipe;
+
+        pthread_mutex_lock(&pp->lock);
+        pp->stop = 1;
+        pthread_cond_signal(&pp->nonfull);
+        pthread_mutex_unlock(&pp->lock);
+        pthread_join(pp->tid, NULL);
+        pthread_mutex_destroy(&pp->lock);
+        pthread_cond_destroy(&pp->nonempty);
+        pthread_cond_destroy(&pp->nonfull);
+        sclose(pp->sp);
+        free(pp);
+        sclose(ps);
 }
 
-/* Read a quote expression. */
+/*
+ * Parse a non-pair expression.  The symbols that are already in lower
+ * case are taken straight from the token.
+ */
 static exp_t *
-read_quote(unsigned level)
+parse_atm(const char *s, int len)
 {
-        return enclose(QUOTE, level);
+        char buf[FMAXDIG+1], *p;
+        exp_t *ep;
+        int i;
+
+        if ((isdigit((unsigned char)*s) || *s == '+' || *s == '-' ||
+             *s == '.') && (ep = strtonum(s, len)) != NULL)
+                return ep;
+        for (i = 0; i < len && !isupper((unsigned char)s[i]); i++)
+                ;
+        if (i == len)
+                return natm(s, len);
+
+        p = (len < (int)sizeof(buf) ? buf : smalloc(len));
+        for (i = 0; i < len; i++)
+                p[i] = tolower((unsigned char)s[i]);
+        ep = natm(p, len);
+        if (p != buf)
+                free(p);
+        return ep;
 }
 
-/* Read a quasi-quote expression. */
-static exp_t *
-read_qquote(unsigned level)
+/*
+ * Return the length of the token starting at s and move the cursor
+ * after it.  A token never spans a line so it's always entirely in
+ * the buffer of the stream.
+ */
+static inline int
+toklen(char *s)
 {
-        return enclose(QQUOTE, level);
+        instream->cur = skiptoken(s, instream->end);
+        return instream->cur - s;
 }
 
-/* Read a comma expression. */
+/* Read an atom starting at s in the input stream. */
 static exp_t *
-read_comma(unsigned level)
+read_atm(char *s)
 {
-        char c;
-        exp_t *exp;
+        return parse_atm(s, toklen(s));
+}
 
-        TRY
-                if ((c = sgetchar()) != '@') {
-                        sungetch(c);
-                        exp = enclose(UNQUOTE, level);
-                } else
-                        exp = enclose(SPLICE, level);
-        CATCH(eof_error)
-                eoferr();
-        ENDTRY;
-        return exp;
+/* Read a string from the input stream.*/
+static exp_t *
+read_str(void)
+{
+        stream *sp = instream;
+        unsigned line, col;
+        size_t start;
+        char *q;
+
+        start = sp->cur - sp->buf;
+        while ((q = memchr(sp->cur, '"', sp->end - sp->cur)) == NULL) {
+                sp->cur = sp->end;
+                if (!sfill(sp)) {
+                        sp->cur = sp->buf + start;
+                        line = sline(sp);
+                        col  = scol(sp);
+                        sp->cur = sp->end;
+                        raise(&read_error, sp->name, line, col,
+                              "unmatched quote");
+                }
+        }
+        sp->cur = q + 1;
+        return nstr(sp->buf + start, q - (sp->buf + start));
 }
 
 /* Read a sharp expression. */
 static exp_t *
 read_sharp(void)
 {
-        exp_t *exp;
-        char c, ch;
-
-        TRY
-                switch (c = sgetchar()) {
-                case 't':
-                case 'f':
-                        if (!issep(ch = sgetchar()))
-                                RAISE(read_error, "bad syntax #%c...", c);
-                        sungetch(ch);
-                        exp = (c == 't' ? true : false);
-                        break;
-                case '\\':      /* character? */
-                        exp = read_char();
-                        break;
-                default:
-                        RAISE(read_error, "bad syntax #%c", c);
-                        break;
-                }
-        CATCH(eof_error)
+        exp_t *exp = NULL;
+        int c, ch;
+
+        switch (c = sgetchar()) {
+        case 't':
+        case 'f':
+                if ((ch = sgetchar()) != EOF && !issep(ch))
+                        RAISE(read_error, "bad syntax #%c...", c);
+                sungetch(ch);
+                exp = (c == 't' ? true : false);
+                break;
+        case '\\':      /* character? */
+                exp = read_char();
+                break;
+        case EOF:
                 eoferr();
-        ENDTRY;
+                break;
+        default:
+                RAISE(read_error, "bad syntax #%c", c);
+                break;
+        }
 
         return exp;
 }
@@ -357,59 +678,25 @@ read_sharp(void)
 static exp_t *
 read_char()
 {
-        buf_t *bp;
-        exp_t *exp;
-        register char c;
         unsigned line, col;
+        char *s;
+        int len;
 
-        bp = binit();
-        line = instream->line;
-        col  = instream->col;
-
-        TRY
-                while (!issep(c = sgetchar()))
-                        bputc(c, bp);
-        CATCH(eof_error)
+        s = instream->cur;
+        if ((len = toklen(s)) == 0 && s == instream->end)
                 eoferr();
-        ENDTRY;
-        sungetch(c);
-
-        if (bp->len == 1 && isprint(bp->buf[0]))
-                exp = nchar(bp->buf[0]);
-        else if (bp->len == 7 && !strncmp("newline", bp->buf, 7))
-                exp = nchar('\n');
-        else if (bp->len == 5 && !strncmp("space", bp->buf, 5))
-                exp = nchar(' ');
-        else
-                raise(&read_error, instream->name, line, col,
-                      "bad character constant #\\%.*s", bp->len, bp->buf);
-        bfree(bp);
-        return exp;
-}
 
-/* Read a right parenthesis. */
-static exp_t *
-read_rparen()
-{
-        RAISE(read_error, "unexpected )");
+        if (len == 1 && isprint((unsigned char)s[0]))
+                return nchar(s[0]);
+        else if (len == 7 && !strncmp("newline", s, 7))
+                return nchar('\n');
+        else if (len == 5 && !strncmp("space", s, 5))
+                return nchar(' ');
+        instream->cur = s;
+        line = sline(instream);
+        col  = scol(instream);
+        instream->cur = s + len;
+        raise(&read_error, instream->name, line, col,
+              "bad character constant #\\%.*s", len, s);
         return NULL;            /* not reached */
 }
-
-/* Read a dot expression. */
-static exp_t *
-read_dot()
-{
-        char c;
-        unsigned dotline, dotcol;
-
-        dotline = instream->line;
-        dotcol  = instream->col;
-        TRY
-                if (issep(c = sgetchar()))
-                        doterr(dotline, dotcol);
-        CATCH(eof_error)
-                doterr(dotline, dotcol);
-        ENDTRY;
-        sungetch(c);
-        return read_atm('.');
-}
@@ -4,10 +4,13 @@
 #include "stream.h"
 
 extern const excpt_t read_error;
-extern unsigned topexplin;
-extern unsigned topexpcol;
+extern TLS unsigned topexplin;
+extern TLS unsigned topexpcol;
 
-extern exp_t *read(void);
+extern exp_t  *read(void);
+extern exp_t  *readpar(char *);
+extern stream *rstart(stream *);
+extern void    rstop(stream *);
 
 #define RAISE1(e, ...)	raise(&(e), instream->name, topexplin, topexpcol, \
                               __VA_ARGS__)
@@ -0,0 +1,184 @@
+#include "extern.h"
+#include "scan.h"
+
+/*
+ * The reader spends most of its time looking for the end of a run of
+ * white-spaces or of a token.  When the processor allows it, 16 or 32
+ * characters are classified at once with SSE2 or AVX2 instructions,
+ * and the scalar versions are used for the remaining characters.  The
+ * version used is chosen on the first call.
+ */
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_SSE2
+#define HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+/* Return the first character of [p, end) that is not a white-space. */
+static char *
+spacescal(char *p, char *end)
+{
+        while (p < end && isspace((unsigned char)*p))
+                p++;
+        return p;
+}
+
+/* Return the first separator of [p, end). */
+static char *
+tokenscal(char *p, char *end)
+{
+        while (p < end && !issep((unsigned char)*p))
+                p++;
+        return p;
+}
+
+#ifdef HAVE_SSE2
+/*
+ * Return the mask of the white-spaces among the 16 characters x, that
+ * is the space and the characters from \t to \r.
+ */
+static inline __m128i
+spaces16(__m128i x)
+{
+        __m128i d;
+
+        d = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+        return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                            _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(4)),
+                                           d));
+}
+
+/* Return the mask of the separators among the 16 characters x. */
+static inline __m128i
+seps16(__m128i x)
+{
+        __m128i m;
+
+        m = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('(')),
+                         _mm_cmpeq_epi8(x, _mm_set1_epi8(')')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(';')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('"')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('\'')));
+        return _mm_or_si128(m, spaces16(x));
+}
+
+static char *
+spacesse2(char *p, char *end)
+{
+        unsigned m;
+
+        for (; end-p >= 16; p += 16) {
+                m = _mm_movemask_epi8(spaces16(_mm_loadu_si128((__m128i *)p)));
+                if ((m = ~m & 0xffff) != 0)
+                        return p + __builtin_ctz(m);
+        }
+        return spacescal(p, end);
+}
+
+static char *
+tokensse2(char *p, char *end)
+{
+        unsigned m;
+
+        for (; end-p >= 16; p += 16) {
+                m = _mm_movemask_epi8(seps16(_mm_loadu_si128((__m128i *)p)));
+                if (m != 0)
+                        return p + __builtin_ctz(m);
+        }
+        return tokenscal(p, end);
+}
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_AVX2
+#define AVX2	__attribute__((target("avx2")))
+
+/* Same as spaces16 and seps16 for 32 characters. */
+static inline AVX2 __m256i
+spaces32(__m256i x)
+{
+        __m256i d;
+
+        d = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+        return _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                               _mm256_cmpeq_epi8(_mm256_min_epu8(d,
+                                                 _mm256_set1_epi8(4)), d));
+}
+
+static inline AVX2 __m256i
+seps32(__m256i x)
+{
+        __m256i m;
+
+        m = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('(')),
+                            _mm256_cmpeq_epi8(x, _mm256_set1_epi8(')')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(';')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\'')));
+        return _mm256_or_si256(m, spaces32(x));
+}
+
+static AVX2 char *
+spaceavx2(char *p, char *end)
+{
+        unsigned m;
+
+        for (; end-p >= 32; p += 32) {
+                m = _mm256_movemask_epi8(spaces32(_mm256_loadu_si256(
+                                                  (__m256i *)p)));
+                if ((m = ~m) != 0)
+                        return p + __builtin_ctz(m);
+        }
+        return spacesse2(p, end);
+}
+
+static AVX2 char *
+tokenavx2(char *p, char *end)
+{
+        unsigned m;
+
+        for (; end-p >= 32; p += 32) {
+                m = _mm256_movemask_epi8(seps32(_mm256_loadu_si256(
+                                                (__m256i *)p)));
+                if (m != 0)
+                        return p + __builtin_ctz(m);
+        }
+        return tokensse2(p, end);
+}
+#endif /* HAVE_AVX2 */
+
+/* Choose the versions of the scanning functions for this processor. */
+static void
+initscan(void)
+{
+        skipspace = spacescal;
+        skiptoken = tokenscal;
+#ifdef HAVE_SSE2
+        skipspace = spacesse2;
+        skiptoken = tokensse2;
+#endif
+#ifdef HAVE_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+                skipspace = spaceavx2;
+                skiptoken = tokenavx2;
+        }
+#endif
+}
+
+static char *
+spaceinit(char *p, char *end)
+{
+        initscan();
+        return skipspace(p, end);
+}
+
+static char *
+tokeninit(char *p, char *end)
+{
+        initscan();
+        return skiptoken(p, end);
+}
+
+char *(*skipspace)(char *, char *) = spaceinit;
+char *(*skiptoken)(char *, char *) = tokeninit;
@@ -0,0 +1,12 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+/*
+ * Scanning of the characters of a buffer.  Both functions return a
+ * pointer to the first character of [p, end) that is respectively not
+ * a white-space or a separator (see issep), or end if there is none.
+ */
+extern char *(*skipspace)(char *p, char *end);
+extern char *(*skiptoken)(char *p, char *end);
+
+#endif /* !SCAN_H */
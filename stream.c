@@ -1,7 +1,12 @@
+#define _POSIX_C_SOURCE 200809L /* for fileno */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "extern.h"
 #include "stream.h"
 
-stream *instream;               /* current input stream */
+TLS stream *instream;           /* current input stream */
 const excpt_t eof_error = { "eof" };
 
 /* Return a new stream. */
@@ -9,12 +14,33 @@ stream *
 nstream(char *name, FILE *fp)
 {
         stream *sp;
+        struct stat st;
+        void *map;
 
         NEW(sp);
         sp->name = sstrdup(name);
         sp->fp = fp;
-        sp->line = 1;
-        sp->col = 0;
+        sp->pipe = NULL;
+        sp->buf = NULL;
+        sp->size = 0;
+        sp->mapped = 0;
+        sp->off = 0;
+        sp->line = sp->bline = 1;
+        sp->col = sp->bcol = 0;
+
+        /* Map the regular files that aren't read yet. */
+        if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > 0 && ftell(fp) == 0 &&
+            (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                        fileno(fp), 0)) != MAP_FAILED) {
+                sp->buf = map;
+                sp->size = st.st_size;
+                sp->mapped = 1;
+                sp->end = sp->buf + st.st_size;
+        }
+        sp->cur = sp->lpos = sp->buf;
+        if (!sp->mapped)
+                sp->end = sp->buf;
 
         return sp;
 }
@@ -33,11 +59,111 @@ sopen(char *path)
         return nstream(basename(path), fp);
 }
 
+/*
+ * Return a stream reading the characters from s to end of the mapped
+ * stream sp.  The first one is at the given line and column.
+ */
+stream *
+sslice(stream *sp, char *s, char *end, unsigned line, unsigned col)
+{
+        stream *cp;
+
+        NEW(cp);
+        *cp = *sp;
+        cp->name = sstrdup(sp->name);
+        cp->fp = NULL;
+        cp->buf = cp->cur = cp->lpos = s;
+        cp->end = end;
+        cp->size = 0;
+        cp->off = sp->off + (s - sp->buf);
+        cp->line = cp->bline = line;
+        cp->col = cp->bcol = col;
+
+        return cp;
+}
+
 /* Close a stream. */
 void
 sclose(stream *sp)
 {
-        fclose(sp->fp);
+        if (sp->fp != NULL) {   /* not a slice of another stream */
+                if (sp->mapped)
+                        munmap(sp->buf, sp->size);
+                else
+                        free(sp->buf);
+                fclose(sp->fp);
+        }
         free(sp->name);
         free(sp);
 }
+
+/*
+ * Read the next line of a stream that isn't mapped at the end of its
+ * buffer.  Return 0 if there is nothing more to read.
+ */
+int
+sfill(stream *sp)
+{
+        size_t len, n, m;
+        char *buf;
+
+        if (sp->mapped)
+                return 0;
+        len = sp->end - sp->buf;
+        n = len;
+        for (;;) {
+                if (sp->size - n < 2) {
+                        buf = srealloc(sp->buf, sp->size ? 2*sp->size : BUFSIZ);
+                        sp->cur = buf + (sp->cur - sp->buf);
+                        sp->lpos = buf + (sp->lpos - sp->buf);
+                        sp->buf = buf;
+                        sp->size = sp->size ? 2*sp->size : BUFSIZ;
+                }
+                if (fgets(sp->buf+n, sp->size-n, sp->fp) == NULL)
+                        break;
+                if ((m = strlen(sp->buf+n)) == 0)
+                        break;
+                n += m;
+                if (sp->buf[n-1] == '\n')
+                        break;
+        }
+        sp->end = sp->buf + n;
+        return n > len;
+}
+
+/*
+ * Drop the characters of a stream that isn't mapped once they are
+ * all read so that its buffer doesn't grow with the file.
+ */
+void
+sdrop(stream *sp)
+{
+        if (sp->mapped || sp->cur != sp->end)
+                return;
+        ssync(sp);
+        sp->bline = sp->line;
+        sp->bcol = sp->col;
+        sp->off += sp->cur - sp->buf;
+        sp->cur = sp->end = sp->lpos = sp->buf;
+}
+
+/* Compute the line and the column of the cursor of a stream. */
+stream *
+ssync(stream *sp)
+{
+        register char *p;
+
+        if (sp->cur < sp->lpos) {
+                sp->lpos = sp->buf;
+                sp->line = sp->bline;
+                sp->col = sp->bcol;
+        }
+        for (p = sp->lpos; p < sp->cur; p++)
+                if (*p == '\n') {
+                        sp->line++;
+                        sp->col = 0;
+                } else
+                        sp->col++;
+        sp->lpos = p;
+        return sp;
+}
@@ -1,48 +1,68 @@
 #ifndef STREAM_H
 #define STREAM_H
 
+/*
+ * The characters of a stream are read from a buffer through a cursor.
+ * Regular files are mapped in memory as a whole, and the other files
+ * are read in the buffer a line at a time when the cursor reaches its
+ * end.  The position of the cursor in lines and columns is only
+ * computed when it's asked for.
+ */
 typedef struct stream {
         char     *name;
+        struct rdpipe *pipe;    /* reader thread feeding the stream */
         FILE     *fp;
+        char     *buf;          /* characters of the stream */
+        char     *cur;          /* cursor in buf */
+        char     *end;          /* end of the characters in buf */
+        size_t    size;         /* size of buf if it's not mapped */
+        int       mapped;       /* is buf the mapped file? */
+        long      off;          /* offset of buf in the file */
+        char     *lpos;         /* position where line and col are known */
         unsigned  line;
         unsigned  col;
+        unsigned  bline;        /* position of the start of buf */
+        unsigned  bcol;
 } stream;
 
-extern stream *instream;
+extern TLS stream *instream;
 extern const excpt_t  eof_error;
 
 stream *nstream(char *, FILE *);
 stream *sopen(char *path);
 void    sclose(stream *);
+stream *sslice(stream *, char *, char *, unsigned, unsigned);
+int     sfill(stream *);
+void    sdrop(stream *);
+stream *ssync(stream *);
 
-/* Get a character from the input stream. */
-static inline char
+/* Get a character from the input stream or EOF at its end. */
+static inline int
 sgetc(stream *sp)
 {
-        int c;
-
-        if ((c = fgetc(sp->fp)) == EOF)
-                raise(&eof_error, sp->name, sp->line, sp->col, "end of file");
-        if (c == '\n') {
-                sp->line++;
-                sp->col = 0;
-        } else
-                sp->col++;
-
-        return c;
+        if (sp->cur == sp->end && !sfill(sp))
+                return EOF;
+        return (unsigned char)*sp->cur++;
 }
 
 /* Push-back a non white-space character into the input stream. */
 static inline void
 sungetc(int c, stream *sp)
 {
-        if (!isspace(c)) {
-                if (ungetc(c, sp->fp) == EOF)
-                        err_sys("sungetc");
-                sp->col--;
-        }
+        if (c != EOF && !isspace(c))
+                sp->cur--;
+}
+
+/* Return the offset of the cursor in the file. */
+static inline long
+stell(stream *sp)
+{
+        return sp->off + (sp->cur - sp->buf);
 }
 
+#define sline(sp)	(ssync(sp)->line)
+#define scol(sp)	(ssync(sp)->col)
+
 #define sgetchar()	sgetc(instream)
 #define sungetch(c)	sungetc(c, instream)
 
@@ -1,67 +1,141 @@
+#include <math.h>
+#include <stdint.h>
+
 #include "extern.h"
 #include "exp.h"
 #include "type.h"
 
-/* Returns the length of the prefix of s representing an integer. */
-static int
-intlen(const char *s, int len)
-{
-        const char *cp;
+#define MAXSIG  19              /* significant digits kept in a uint64_t */
 
-        if (*(cp = s) == '+' || *cp == '-') {
-                if (len == 1)
-                        return 0;
-                cp++;
-        }
-        while (cp-s < len && isdigit(*cp))
-                cp++;
-        return cp-s;
-}
+/* Powers of ten represented exactly by a double. */
+static const double tens[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-/* Test if the string is an integer */
-int
-isintstr(const char *s, int len)
+/*
+ * Return the double nearest to w*10^e10, the absolute value of the
+ * float of the len characters s.  When w fits in the mantissa of a
+ * double and the power of ten is exact, a single multiplication or
+ * division rounds correctly (Clinger's fast path), which is the case
+ * of most of the numbers read.  The other ones, including those with
+ * more than MAXSIG significant digits, are left to strtod.
+ */
+static double
+todouble(const char *s, int len, uint64_t w, int e10, int inexact)
 {
-        return intlen(s, len) == len;
+        char buf[FMAXDIG+1], *p;
+        double d;
+
+        if (w == 0 && !inexact)
+                return 0.0;
+        if (!inexact && w <= (1ULL<<53)) {
+                if (e10 >= 0 && e10 <= 22)
+                        return w * tens[e10];
+                if (e10 < 0 && e10 >= -22)
+                        return w / tens[-e10];
+                if (e10 > 22) {
+                        for (; e10 > 22 && w <= (1ULL<<53)/10; e10--)
+                                w *= 10;        /* still exact */
+                        if (e10 == 22)
+                                return w * tens[e10];
+                }
+        }
+        p = (len < (int)sizeof(buf) ? buf : smalloc(len+1));
+        memcpy(p, s, len);
+        p[len] = '\0';
+        d = strtod(p, NULL);
+        if (p != buf)
+                free(p);
+        return fabs(d);
 }
 
-/* Test if the string is a rational */
-int
-isratstr(const char *s, int len)
+/*
+ * Read the digits starting at *pp into *wp and return their number.
+ * Only the first MAXSIG significant digits are kept, *e10 is the power
+ * of ten to apply to *wp for the others and *inexact is set if one of
+ * them isn't zero.
+ */
+static inline int
+digits(const char **pp, const char *end, uint64_t *wp, int *nsig, int *e10,
+       int *inexact, int isfrac)
 {
-        int offset;
+        const char *p;
+        int d;
 
-        if ((offset = intlen(s, len)) == len)
-                return 1;
-        else if (offset == 0 || *(s+offset) != '/')
-                return 0;
-        s += (offset+1), len -= (offset+1);
-        return (*s != '+' && *s != '-' ? intlen(s, len) == len : 0);
+        for (p = *pp; p < end && (d = *p - '0') >= 0 && d <= 9; p++)
+                if (*nsig < MAXSIG) {
+                        if ((*wp = 10 * *wp + d) != 0)
+                                (*nsig)++;
+                        *e10 -= isfrac;
+                } else {
+                        *e10 += !isfrac;
+                        *inexact |= d != 0;
+                }
+        d = p - *pp;
+        *pp = p;
+        return d;
 }
 
-/* Test if the string is a float */
-int
-isfloatstr(const char *s, int len)
+/*
+ * Return the number represented by the len characters of s, or NULL
+ * if they don't represent one.  The integers, rationals and floats
+ * are recognized and converted in a single pass.  The integers and
+ * rationals that don't fit in an int are converted to floats.
+ */
+exp_t *
+strtonum(const char *s, int len)
 {
-        int offset;
+        const char *p = s, *end = s+len;
+        uint64_t w = 0, dw = 0;
+        int neg, nd, nsig = 0, e10 = 0, inexact = 0, isflt = 0;
+        int dsig = 0, de10 = 0, esign, ex;
+        double d;
 
-        if ((offset = intlen(s, len)) == 0 && *s != '.')
-                return 0;
-        s += offset, len -= offset, offset = 0;
-        switch (*s) {
-        case '.':
-                if (*(s+1) == '+' ||
-                    *(s+1) == '-' ||
-                    (offset = intlen(++s, --len)) == 0 ||
-                    (*(s+offset) != 'e' && *(s+offset) != 'E'))
-                        return (offset && offset == len ? 1 : 0);
-                s += offset, len -= offset;
-        case 'e':
-        case 'E':
-                return (--len && (intlen(++s, len) == len) ? 1 : 0);
-        break;
+        if ((neg = (p < end && *p == '-')) || (p < end && *p == '+')) {
+                if (len == 6 && !strncmp(p+1, "inf.0", 5))
+                        return nfloat(neg ? -HUGE_VAL : HUGE_VAL);
+                if (len == 6 && !strncmp(p+1, "nan.0", 5))
+                        return nfloat(NAN);
+                p++;
+        }
+        nd = digits(&p, end, &w, &nsig, &e10, &inexact, 0);
+        if (p < end && *p == '/') {     /* rational */
+                p++;
+                if (nd == 0 || digits(&p, end, &dw, &dsig, &de10, &inexact,
+                                      0) == 0 || p != end || dw == 0)
+                        return NULL;
+                if (e10 == 0 && de10 == 0 && w <= INT_MAX && dw <= INT_MAX)
+                        return nrat(neg ? -(int)w : (int)w, (int)dw);
+                d = w * pow(10, e10) / (dw * pow(10, de10));
+                return nfloat(neg ? -d : d);
+        }
+        if (p < end && *p == '.') {
+                p++;
+                isflt = 1;
+                nd += digits(&p, end, &w, &nsig, &e10, &inexact, 1);
+        }
+        if (nd == 0)
+                return NULL;
+        if (p < end && (*p == 'e' || *p == 'E')) {
+                isflt = 1;
+                if (++p < end && (*p == '+' || *p == '-'))
+                        esign = (*p++ == '-' ? -1 : 1);
+                else
+                        esign = 1;
+                if (p == end)
+                        return NULL;
+                for (ex = 0; p < end && isdigit((unsigned char)*p); p++)
+                        if (ex < 100000)
+                                ex = 10*ex + (*p - '0');
+                e10 += esign*ex;
         }
-        return 0;
+        if (p != end)
+                return NULL;
+        if (!isflt && e10 == 0 && w <= (uint64_t)INT_MAX + neg)
+                return nfixnum(neg ? (int)-(int64_t)w : (int)w);
+        d = todouble(s, len, w, e10, inexact);
+        return nfloat(neg ? -d : d);
 }
 
 /* Test if the expression is self-evaluating */
@@ -1,9 +1,7 @@
 #ifndef TYPE_H
 #define TYPE_H
 
-extern int isintstr(const char *, int);
-extern int isfloatstr(const char *, int);
-extern int isratstr(const char *, int);
+extern exp_t *strtonum(const char *, int);
 extern int isself(exp_t *);
 
 /* Test if an expression is an integer */
@@ -69,6 +67,13 @@ iscond(exp_t *ep)
         return istag(ep, keywords[COND]);
 }
 
+/* Test if the expression is a case expression */
+static inline int
+iscase(exp_t *ep)
+{
+        return istag(ep, keywords[CASE]);
+}
+
 /* Test if an expression is a begin expression */
 static inline int
 isbegin(exp_t *ep)
@@ -104,6 +109,27 @@ islet(exp_t *ep)
         return istag(ep, keywords[LET]);
 }
 
+/* Test if an expression is a do expression */
+static inline int
+isdo(exp_t *ep)
+{
+        return istag(ep, keywords[DO]);
+}
+
+/* Test if an expression is a receive expression */
+static inline int
+isreceive(exp_t *ep)
+{
+        return istag(ep, keywords[RECEIVE]);
+}
+
+/* Test if an expression is an import expression */
+static inline int
+isimport(exp_t *ep)
+{
+        return istag(ep, keywords[IMPORT]);
+}
+
 /* Test if an expression is a set! expression */
 static inline int
 isset(exp_t *ep)